@@ -0,0 +1,25 @@
+/*
+ * Shared code of the benchmarks and budget tests
+ */
+
+/*
+ * Number of allocations made through operator new so far
+ */
+
+extern ullong allocations;
+
+/*
+ * Synthetic mingw-w64 / clang installations
+ */
+
+constexpr char SYSROOTTARGET[] = "x86_64-w64-mingw32";
+
+struct sysroot {
+    const char *name;
+    std::string mingwpath; /* MINGW_PATH */
+    std::string bindir;    /* clang and <target>-gcc */
+};
+
+bool createsysroots(std::string &base, std::vector<sysroot> &roots,
+                    std::string &longpath);
+void removesysroots(const std::string &base);
@@ -0,0 +1,212 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+/*
+ * Generates the directory layouts of the distributions wclang
+ * knows about, placed on tmpfs (/dev/shm) if available:
+ *
+ * debian: usr/lib/gcc/<target>/<ver>-<posix|win32>,
+ *         usr/<target>/include, gcc-posix alternatives symlink
+ * mxe:    usr/<target>/include, binaries in bin
+ * fedora: usr/<target>/sys-root/mingw/include
+ *
+ * The debian layout also has many clang resource directories,
+ * 'longpath' is a PATH of 256 entries ending in its bin dir.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <sys/stat.h>
+#include <ftw.h>
+#include <unistd.h>
+#include "wclang.h"
+#include "bench.h"
+
+static constexpr const char* CLANGVERSIONS[] = {
+    "3.4", "3.5.0", "3.6.2", "3.7.1", "3.8.0", "3.8.1", "3.9.0", "3.9.1",
+    "4.0.0", "4.0.1", "5.0.0", "5.0.1", "5.0.2", "6.0.0", "6.0.1", "7.0.0",
+    "7.0.1", "7.1.0", "8.0.0", "8.0.1", "9.0.0", "9.0.1", "10.0.0", "10.0.1"
+};
+
+static constexpr const char* GCCVERSIONS[] = {
+    "5.3", "6.3", "7.3", "8.3"
+};
+
+static bool makedirs(const std::string &dir)
+{
+    for (size_t pos = 1; pos <= dir.size(); ++pos)
+    {
+        if (pos != dir.size() && dir[pos] != '/')
+            continue;
+
+        if (mkdir(dir.substr(0, pos).c_str(), 0755) && errno != EEXIST)
+            return false;
+    }
+
+    return true;
+}
+
+static bool makefile(const std::string &file, bool executable = false)
+{
+    size_t pos = file.find_last_of('/');
+
+    if (!makedirs(file.substr(0, pos)))
+        return false;
+
+    std::ofstream f(file.c_str());
+
+    if (executable)
+        f << "#!/bin/sh\nexit 0\n";
+
+    return f && (!executable || !chmod(file.c_str(), 0755));
+}
+
+static bool makebinaries(const std::string &bindir, bool debian = false)
+{
+    const std::string t = SYSROOTTARGET;
+
+    if (!makefile(bindir + "/clang", true) || !makefile(bindir + "/clang++", true))
+        return false;
+
+    if (!debian)
+    {
+        return makefile(bindir + "/" + t + "-gcc", true) &&
+               makefile(bindir + "/" + t + "-g++", true);
+    }
+
+    /* update-alternatives */
+
+    return makefile(bindir + "/" + t + "-gcc-posix", true) &&
+           makefile(bindir + "/" + t + "-g++-posix", true) &&
+           !symlink((t + "-gcc-posix").c_str(), (bindir + "/" + t + "-gcc").c_str()) &&
+           !symlink((t + "-g++-posix").c_str(), (bindir + "/" + t + "-g++").c_str());
+}
+
+static bool createdebian(const std::string &root)
+{
+    const std::string t = SYSROOTTARGET;
+
+    if (!makebinaries(root + "/usr/bin", true) ||
+        !makefile(root + "/usr/" + t + "/include/stdlib.h"))
+        return false;
+
+    for (const char *v : GCCVERSIONS)
+    {
+        for (const char *variant : { "-posix", "-win32" })
+        {
+            std::string dir = root + "/usr/lib/gcc/" + t + "/" + v + variant;
+
+            if (!makefile(dir + "/include/c++/iostream") ||
+                !makedirs(dir + "/include/c++/" + t) || !makedirs(dir + "/" + t) ||
+                !makefile(dir + "/libgcc.a"))
+                return false;
+        }
+    }
+
+    for (const char *v : CLANGVERSIONS)
+        if (!makefile(root + "/usr/lib/clang/" + v + "/include/xmmintrin.h")) return false;
+
+    return true;
+}
+
+static bool createmxe(const std::string &root)
+{
+    const std::string t = SYSROOTTARGET;
+    std::string cxx = root + "/usr/" + t + "/include/c++/8.3.0";
+
+    return makebinaries(root + "/bin") &&
+           makefile(root + "/usr/" + t + "/include/stdlib.h") &&
+           makefile(cxx + "/iostream") && makedirs(cxx + "/" + t) &&
+           makefile(root + "/lib/gcc/" + t + "/8.3.0/libgcc.a") &&
+           makefile(root + "/lib/clang/9.0.0/include/xmmintrin.h");
+}
+
+static bool createfedora(const std::string &root)
+{
+    const std::string t = SYSROOTTARGET;
+    std::string inc = root + "/usr/" + t + "/sys-root/mingw/include";
+
+    return makebinaries(root + "/usr/bin") &&
+           makefile(inc + "/stdlib.h") && makefile(inc + "/c++/iostream") &&
+           makedirs(inc + "/c++/" + t) &&
+           makefile(root + "/usr/lib/gcc/" + t + "/8.3.0/libgcc.a") &&
+           makefile(root + "/usr/lib/clang/9.0.0/include/xmmintrin.h");
+}
+
+bool createsysroots(std::string &base, std::vector<sysroot> &roots,
+                    std::string &longpath)
+{
+    const char *tmp = getenv("TMPDIR");
+    char dir[PATH_MAX];
+    struct stat st;
+
+    if (!stat("/dev/shm", &st) && S_ISDIR(st.st_mode) && !access("/dev/shm", W_OK))
+        tmp = "/dev/shm";
+    else if (!tmp || !*tmp)
+        tmp = "/tmp";
+
+    snprintf(dir, sizeof(dir), "%s/wclang_sysroot.XXXXXX", tmp);
+
+    if (!mkdtemp(dir))
+        return false;
+
+    base = dir;
+
+    if (!createdebian(base + "/debian") || !createmxe(base + "/mxe") ||
+        !createfedora(base + "/fedora"))
+    {
+        removesysroots(base);
+        return false;
+    }
+
+    roots.push_back({ "debian", base + "/debian/usr/bin", base + "/debian/usr/bin" });
+    roots.push_back({ "mxe", base + "/mxe/bin", base + "/mxe/bin" });
+    roots.push_back({ "fedora", base + "/fedora/usr/bin", base + "/fedora/usr/bin" });
+
+    longpath.clear();
+
+    for (int i = 0; i < 256; ++i)
+    {
+        std::string d = base + "/path/" + std::to_string(i);
+
+        if (!makedirs(d))
+            return false;
+
+        longpath += d + ":";
+    }
+
+    longpath += roots[0].bindir;
+    return true;
+}
+
+void removesysroots(const std::string &base)
+{
+    if (base.empty())
+        return;
+
+    nftw(base.c_str(), [](const char *file, const struct stat *, int, struct FTW *)
+    {
+        return remove(file);
+    }, 16, FTW_DEPTH | FTW_PHYS);
+}
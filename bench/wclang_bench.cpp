@@ -0,0 +1,296 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+/*
+ * wclang_bench: per-invocation cost of the toolchain lookup,
+ * argument parsing and the full command assembly, measured
+ * against synthetic mingw installations (see sysroot.cpp)
+ *
+ * Every benchmark is calibrated to run for at least 10 ms per
+ * round, the median of 15 rounds is reported together with the
+ * median absolute deviation and the heap allocations per call.
+ */
+
+#define WCLANG_NO_MAIN
+#include "../src/wclang.cpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <time.h>
+#include "bench.h"
+
+static ullong getnanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+struct benchargs {
+    string_vector intrinpaths;
+    string_vector stdpaths;
+    string_vector cxxpaths;
+    string_vector cflags;
+    string_vector cxxflags;
+    string_vector linkerflags;
+    string_vector env;
+    std::string target;
+    std::string compiler;
+    std::string compilerpath;
+    std::string compilerbinpath;
+    bool iscxx;
+    commandargs cmdargs;
+
+    benchargs() : target(SYSROOTTARGET), iscxx(false),
+                  cmdargs(intrinpaths, stdpaths, cxxpaths, cflags, cxxflags,
+                          linkerflags, target, compiler, compilerpath,
+                          compilerbinpath, env, iscxx) {}
+};
+
+static constexpr int ROUNDS = 15;
+static constexpr ullong MINROUNDTIME = 10000000; /* ns */
+
+template<class F>
+static void bench(const std::string &name, F fun)
+{
+    std::vector<double> results;
+    ullong iterations = 1;
+    ullong allocs;
+
+    /* calibrate */
+
+    for (;;)
+    {
+        ullong start = getnanoseconds();
+
+        for (ullong i = 0; i < iterations; ++i)
+            fun();
+
+        if (getnanoseconds() - start >= MINROUNDTIME || iterations >= (1ULL << 30))
+            break;
+
+        iterations *= 2;
+    }
+
+    allocs = allocations;
+    fun();
+    allocs = allocations - allocs;
+
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        ullong start = getnanoseconds();
+
+        for (ullong i = 0; i < iterations; ++i)
+            fun();
+
+        results.push_back(double(getnanoseconds() - start) / iterations);
+    }
+
+    std::sort(results.begin(), results.end());
+    double median = results[ROUNDS/2];
+
+    std::vector<double> deviations;
+
+    for (double r : results)
+        deviations.push_back(r > median ? r - median : median - r);
+
+    std::sort(deviations.begin(), deviations.end());
+
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::fixed << std::setprecision(0)
+              << std::setw(12) << median << " ns/op"
+              << "  +- " << std::setw(3) << std::setprecision(1)
+              << deviations[ROUNDS/2] / median * 100.0 << "%"
+              << std::setw(8) << allocs << " allocs/op" << std::endl;
+}
+
+int main()
+{
+    std::string base;
+    std::string longpath;
+    std::vector<sysroot> roots;
+
+    if (!createsysroots(base, roots, longpath))
+    {
+        std::cerr << "cannot create the synthetic sysroots" << std::endl;
+        return 1;
+    }
+
+    std::cout << "sysroots: " << base << std::endl << std::endl;
+
+    std::string cache = base + "/cache";
+    setenv("WCLANG_CACHE_DIR", cache.c_str(), 1);
+    setenv("WCLANG_NO_DAEMON", "1", 1);
+
+    for (const auto &root : roots)
+    {
+        std::string name = root.name;
+        std::string path = root.bindir + ":/usr/bin:/bin";
+
+        setenv("MINGW_PATH", root.mingwpath.c_str(), 1);
+        setenv("PATH", path.c_str(), 1);
+
+        bench(name + ": findstdheader", [&]()
+        {
+            benchargs b;
+            findstdheader(SYSROOTTARGET, b.cmdargs);
+        });
+
+        benchargs headers;
+        findstdheader(SYSROOTTARGET, headers.cmdargs);
+
+        bench(name + ": findcxxheaders", [&]()
+        {
+            benchargs b;
+            b.stdpaths = headers.stdpaths;
+            findcxxheaders(SYSROOTTARGET, b.cmdargs);
+        });
+
+        bench(name + ": findintrinheaders", [&]()
+        {
+            benchargs b;
+            findintrinheaders(b.cmdargs, root.bindir);
+        });
+
+        bench(name + ": findlibgccdir", [&]()
+        {
+            benchargs b;
+            b.cmdargs.mingwbinpath = root.bindir;
+            findlibgccdir(b.cmdargs, root.bindir + "/" + SYSROOTTARGET + "-gcc");
+        });
+
+        /*
+         * Full command assembly, with and without the toolchain cache
+         */
+
+        std::string wrapper = root.bindir + "/" + SYSROOTTARGET + "-clang++";
+        const char *compileargv[] = {
+            wrapper.c_str(), "-O2", "-DNDEBUG", "-Iinclude", "-Wall", "-std=c++11",
+            "-c", "file.cpp", "-o", "file.o", nullptr
+        };
+
+        for (bool cached : { false, true })
+        {
+            if (cached) unsetenv("WCLANG_NO_TOOLCHAIN_CACHE");
+            else setenv("WCLANG_NO_TOOLCHAIN_CACHE", "1", 1);
+
+            bench(name + (cached ? ": buildcommand (cached)" : ": buildcommand"), [&]()
+            {
+                std::string compiler;
+                char **cargs;
+
+                setenv("PATH", path.c_str(), 1);
+
+                if (buildcommand(10, const_cast<char**>(compileargv), compiler, cargs))
+                    std::exit(EXIT_FAILURE);
+            });
+        }
+
+        std::cout << std::endl;
+    }
+
+    /*
+     * PATH walk and argument parsing
+     */
+
+    setenv("PATH", longpath.c_str(), 1);
+
+    bench("wcrealpath (256 PATH entries)", [&]()
+    {
+        std::string result;
+        getpathofcommand("clang", result);
+    });
+
+    {
+        benchargs b;
+        b.compilerbinpath = roots[0].bindir;
+        std::string wrapper = roots[0].bindir + "/" + SYSROOTTARGET + "-clang";
+        const char *argv[] = {
+            wrapper.c_str(), "-O2", "-g", "-DNDEBUG", "-Iinclude", "-Isrc", "-Wall",
+            "-Wextra", "-x", "c++", "-std=c++11", "-fexceptions", "-mwindows",
+            "-c", "file.cpp", "-o", "file.o", nullptr
+        };
+
+        bench("parseargs", [&]()
+        {
+            b.iscxx = false;
+            b.cmdargs.iscompilestep = b.cmdargs.islinkstep = false;
+            b.cmdargs.usemingwlinker = subsystem::standard;
+            parseargs(17, const_cast<char**>(argv), SYSROOTTARGET, b.cmdargs, b.env);
+        });
+
+        /*
+         * CMake style link line
+         */
+
+        string_vector linkargs;
+        std::vector<char*> linkargv;
+
+        linkargs.push_back(wrapper);
+        linkargs.push_back("-o");
+        linkargs.push_back("app.exe");
+
+        for (int i = 0; i < 10000; ++i)
+        {
+            std::string n = std::to_string(i);
+
+            switch (i % 4)
+            {
+                case 0: linkargs.push_back("CMakeFiles/app.dir/src/file" + n + ".cpp.obj"); break;
+                case 1: linkargs.push_back("-lmodule" + n); break;
+                case 2: linkargs.push_back("-Wl,--whole-archive,libmodule" + n + ".a"); break;
+                case 3: linkargs.push_back("-L/usr/lib/module" + n); break;
+            }
+        }
+
+        for (auto &arg : linkargs)
+            linkargv.push_back(&arg[0]);
+
+        linkargv.push_back(nullptr);
+
+        bench("parseargs (10000 link arguments)", [&]()
+        {
+            b.iscxx = false;
+            b.cmdargs.iscompilestep = b.cmdargs.islinkstep = false;
+            b.cmdargs.usemingwlinker = subsystem::standard;
+            parseargs(linkargv.size()-1, linkargv.data(), SYSROOTTARGET, b.cmdargs, b.env);
+        });
+
+        std::string path = roots[0].bindir + ":/usr/bin:/bin";
+
+        setenv("MINGW_PATH", roots[0].mingwpath.c_str(), 1);
+        unsetenv("WCLANG_NO_TOOLCHAIN_CACHE");
+
+        bench("buildcommand (10000 link arguments)", [&]()
+        {
+            std::string compiler;
+            char **cargs;
+
+            setenv("PATH", path.c_str(), 1);
+
+            if (buildcommand(linkargv.size()-1, linkargv.data(), compiler, cargs))
+                std::exit(EXIT_FAILURE);
+        });
+    }
+
+    removesysroots(base);
+    return 0;
+}
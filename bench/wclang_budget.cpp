@@ -0,0 +1,177 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+/*
+ * wclang_budget: counts the stat(), opendir(), readlink(),
+ * realpath() and exec calls as well as the heap allocations
+ * of buildcommand() for every kind of invocation, and fails
+ * if one of them exceeds its budget.
+ *
+ * Run it with --print to show the current numbers.
+ */
+
+#define WCLANG_NO_MAIN
+#include "../src/wclang.cpp"
+
+#include <iomanip>
+#include "bench.h"
+
+struct budget {
+    const char *name;
+    std::vector<const char*> args;
+    bool cached;
+    ullong stat;
+    ullong opendir;
+    ullong readlink;
+    ullong realpath;
+    ullong exec;
+    ullong allocs;
+};
+
+/*
+ * Measured on the synthetic debian layout, the
+ * allocations have 10% headroom for other
+ * standard library implementations
+ */
+
+static const budget BUDGETS[] = {
+    /* name                 args                                 cached
+                            stat opendir readlink realpath exec allocs */
+    { "compile",            { "-c", "file.c", "-o", "file.o" },    false,
+                            47, 10, 0, 2, 0, 143 },
+    { "compile",            { "-c", "file.c", "-o", "file.o" },    true,
+                            13, 0, 0, 0, 0, 144 },
+    { "link",               { "file.o", "-o", "file.exe" },        false,
+                            47, 10, 0, 2, 0, 144 },
+    { "link",               { "file.o", "-o", "file.exe" },        true,
+                            13, 0, 0, 0, 0, 146 },
+    { "-x c++",             { "-x", "c++", "-c", "file.c" },       false,
+                            47, 10, 0, 2, 0, 142 },
+    { "-x c++",             { "-x", "c++", "-c", "file.c" },       true,
+                            13, 0, 0, 0, 0, 144 },
+    { "-wc-use-mingw-linker", { "-wc-use-mingw-linker", "file.o", "-o", "file.exe" }, false,
+                            47, 10, 0, 2, 0, 147 },
+    { "-wc-use-mingw-linker", { "-wc-use-mingw-linker", "file.o", "-o", "file.exe" }, true,
+                            13, 0, 0, 0, 0, 150 }
+};
+
+static void resetcounters()
+{
+    statcalls = opendircalls = readlinkcalls = realpathcalls = execcalls = 0;
+    allocations = 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::string base;
+    std::string longpath;
+    std::vector<sysroot> roots;
+    bool print = argc > 1 && !std::strcmp(argv[1], "--print");
+    int failed = 0;
+
+    if (!createsysroots(base, roots, longpath))
+    {
+        std::cerr << "cannot create the synthetic sysroots" << std::endl;
+        return 1;
+    }
+
+    const sysroot &root = roots[0];
+    std::string path = root.bindir + ":/usr/bin:/bin";
+    std::string cache = base + "/cache";
+    std::string wrapper = root.bindir + "/" + SYSROOTTARGET + "-clang";
+
+    setenv("WCLANG_CACHE_DIR", cache.c_str(), 1);
+    setenv("WCLANG_NO_DAEMON", "1", 1);
+    setenv("MINGW_PATH", root.mingwpath.c_str(), 1);
+
+    std::cout << std::left << std::setw(36) << "invocation" << std::right
+              << std::setw(6) << "stat" << std::setw(9) << "opendir"
+              << std::setw(10) << "readlink" << std::setw(10) << "realpath"
+              << std::setw(6) << "exec" << std::setw(8) << "allocs" << std::endl;
+
+    for (const auto &b : BUDGETS)
+    {
+        std::vector<char*> args;
+        std::string compiler;
+        char **cargs;
+        int ret = 0;
+
+        args.push_back(const_cast<char*>(wrapper.c_str()));
+
+        for (const char *arg : b.args)
+            args.push_back(const_cast<char*>(arg));
+
+        args.push_back(nullptr);
+
+        if (b.cached) unsetenv("WCLANG_NO_TOOLCHAIN_CACHE");
+        else setenv("WCLANG_NO_TOOLCHAIN_CACHE", "1", 1);
+
+        /*
+         * The first run fills the toolchain cache and
+         * initializes function local statics
+         */
+
+        for (int run = 0; run < 2 && !ret; ++run)
+        {
+            setenv("PATH", path.c_str(), 1);
+            resetcounters();
+            ret = buildcommand(args.size()-1, args.data(), compiler, cargs);
+        }
+
+        ullong allocs = allocations;
+        std::string name = std::string(b.name) + (b.cached ? " (cached)" : "");
+
+        if (ret)
+        {
+            std::cerr << name << ": buildcommand() failed" << std::endl;
+            ++failed;
+            continue;
+        }
+
+        std::cout << std::left << std::setw(36) << name << std::right
+                  << std::setw(6) << statcalls << std::setw(9) << opendircalls
+                  << std::setw(10) << readlinkcalls << std::setw(10) << realpathcalls
+                  << std::setw(6) << execcalls << std::setw(8) << allocs << std::endl;
+
+        if (print)
+            continue;
+
+        auto check = [&](const char *what, ullong count, ullong limit)
+        {
+            if (count <= limit)
+                return;
+
+            std::cerr << name << ": " << count << " " << what << " calls exceed "
+                      << "the budget of " << limit << std::endl;
+            ++failed;
+        };
+
+        check("stat", statcalls, b.stat);
+        check("opendir", opendircalls, b.opendir);
+        check("readlink", readlinkcalls, b.readlink);
+        check("realpath", realpathcalls, b.realpath);
+        check("exec", execcalls, b.exec);
+        check("allocation", allocs, b.allocs);
+    }
+
+    removesysroots(base);
+    return failed ? 1 : 0;
+}
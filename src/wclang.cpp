@@ -29,12 +29,24 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
 #include <unistd.h>
 #include <climits>
+#include <cstdint>
 #include <cstdlib>
 #include <cassert>
 #include "wclang.h"
 #include "wclang_time.h"
+#include "wclang_cache.h"
+#include "wclang_daemon.h"
+#include "wclang_jobs.h"
+#include "wclang_options.h"
+#include "wclang_rsp.h"
+#include "wclang_compdb.h"
+#include "wclang_rc.h"
+#include "wclang_distribute.h"
 
 /*
  * Supported targets
@@ -45,23 +57,27 @@ enum {
     TARGET_WIN64
 };
 
-static constexpr const char* TARGET32[] = {
-    "i686-w64-mingw32",
-    "i686-w64-mingw32.static", /* MXE */
-    "i686-w64-mingw32.shared", /* MXE */
-    "i686-pc-mingw32",
-    "i586-mingw32",
-    "i586-mingw32msvc",
-    "i486-mingw32"
+struct tripleinfo {
+    const char *name;
+    int type;
 };
 
-static constexpr const char* TARGET64[] = {
-    "x86_64-w64-mingw32",
-    "x86_64-w64-mingw32.static", /* MXE */
-    "x86_64-w64-mingw32.shared", /* MXE */
-    "amd64-mingw32msvc"
+static constexpr tripleinfo TRIPLES[] = {
+    { "i686-w64-mingw32", TARGET_WIN32 },
+    { "i686-w64-mingw32.static", TARGET_WIN32 }, /* MXE */
+    { "i686-w64-mingw32.shared", TARGET_WIN32 }, /* MXE */
+    { "i686-pc-mingw32", TARGET_WIN32 },
+    { "i586-mingw32", TARGET_WIN32 },
+    { "i586-mingw32msvc", TARGET_WIN32 },
+    { "i486-mingw32", TARGET_WIN32 },
+    { "x86_64-w64-mingw32", TARGET_WIN64 },
+    { "x86_64-w64-mingw32.static", TARGET_WIN64 }, /* MXE */
+    { "x86_64-w64-mingw32.shared", TARGET_WIN64 }, /* MXE */
+    { "amd64-mingw32msvc", TARGET_WIN64 }
 };
 
+static constexpr auto TRIPLEINDEX = maketableindex<16>(TRIPLES);
+
 /*
  * Additional C/C++ flags
  */
@@ -76,6 +92,10 @@ static constexpr const char* ENVVARS[] = {
 };
 
 static constexpr char COMMANDPREFIX[] = "-wc-";
+static constexpr char IMPORTOPT[] = "-wc-import=";
+static constexpr char LLDTHREADSOPT[] = "-Wl,--threads=";
+static constexpr char THINLTOJOBSOPT[] = "-Wl,--thinlto-jobs=";
+static constexpr const char* LINKTHREADSOPTS[] = { LLDTHREADSOPT, THINLTOJOBSOPT };
 
 #ifndef NO_SYS_PATH
 /*
@@ -109,17 +129,22 @@ static bool findcxxheaders(const char *target, commandargs &cmdargs)
     auto &mv = cmdargs.mingwversion;
     auto &cxxpaths = cmdargs.cxxpaths;
     const auto &stdpaths = cmdargs.stdpaths;
-    static const char *_target = target;
+    static const char *_target;
+
+    _target = target; /* not an initializer, the pointer changes between calls */
 
-    auto checkmingwheaders = [](const char *dir, const char *file)
+    auto checkmingwheaders = [](int dirfd, const char *file, unsigned char type)
     {
-        static struct stat st;
-        static std::stringstream d;
+        static std::string d;
+
+        if (!maybedirectory(type))
+            return false;
 
-        clear(d);
-        d << dir << file << "/" << _target;
+        d = file;
+        d += "/";
+        d += _target;
 
-        return !stat(d.str().c_str(), &st);
+        return fileexistsat(dirfd, d.c_str());
     };
 
     auto checkheaderdir = [](const std::string &cxxheaderdir)
@@ -131,6 +156,7 @@ static bool findcxxheaders(const char *target, commandargs &cmdargs)
         file += "/";
         file += "iostream";
 
+        ++statcalls;
         return !stat(file.c_str(), &st);
     };
 
@@ -267,7 +293,7 @@ static bool findcxxheaders(const char *target, commandargs &cmdargs)
             cxxheaders += mv.s;
             cxxheaders += "/include/c++";
 
-            if (!checkmingwheaders(cxxheaders.c_str(), ""))
+            if (!fileexists((cxxheaders + "/" + target).c_str()))
                 continue;
 
             if (checkheaderdir(cxxheaders))
@@ -303,31 +329,36 @@ static bool findintrinheaders(commandargs &cmdargs, const std::string &clangbind
 
     auto trydir = [&]() -> bool
     {
-        listfiles(dir.str().c_str(), nullptr, [](const char *, const char *file)
+        listfiles(dir.str().c_str(), nullptr, [](int dirfd, const char *file, unsigned char type)
         {
-            if (file[0] != '.' && isdirectory(file, dir.str().c_str()))
+            /*
+             * A version directory that is not one (or has no headers)
+             * fails the header lookup, no need to stat it first
+             */
+
+            if (file[0] != '.' && maybedirectory(type))
             {
                 compilerver cv = parsecompilerversion(file);
 
                 if (cv != compilerver())
                 {
-                    static std::stringstream tmp;
-                    clear(tmp);
+                    static std::string intrindir;
+                    static std::string header;
 
-                    auto checkdir = [&](std::stringstream &dir)
+                    auto checkdir = [&](const char *subdir)
                     {
-                        static std::string intrindir;
-                        auto &file = dir;
+                        intrindir = file;
+                        intrindir += subdir;
 
-                        intrindir = dir.str();
-                        file << "/xmmintrin.h";
+                        header = intrindir;
+                        header += "/xmmintrin.h";
 
-                        if (fileexists(file.str().c_str()))
+                        if (fileexistsat(dirfd, header.c_str()))
                         {
                             if (cv > *clangversion)
                             {
                                 *clangversion = cv;
-                                pathtmp.swap(intrindir);
+                                pathtmp = dir.str() + "/" + intrindir;
                             }
                             return true;
                         }
@@ -335,16 +366,9 @@ static bool findintrinheaders(commandargs &cmdargs, const std::string &clangbind
                         return false;
                     };
 
-                    tmp << dir.str() << "/" << file << "/include";
-
-                    if (!checkdir(tmp))
-                    {
-                        clear(tmp);
-                        tmp << dir.str() << "/" << file;
-                        checkdir(tmp);
-                    }
+                    if (!checkdir("/include"))
+                        checkdir("");
                 }
-                return true;
             }
             return true;
         });
@@ -404,6 +428,90 @@ do                                            \
 #undef TRYDIR3
 }
 
+/*
+ * Does the same as <target>-gcc -print-libgcc-file-name
+ * without spawning a shell and the gcc driver.
+ *
+ * a: <gccbindir> / .. / lib / gcc / <target> / <gccver>
+ * b: <gccbindir> / .. / lib / gcc / <target> / <gccver>-<posix|win32> (debian)
+ */
+
+static bool findlibgccdir(commandargs &cmdargs, const std::string &gcc)
+{
+    std::string dir;
+    std::string variant;
+    string_vector versions;
+    compilerver best;
+    const std::string *bestdir = nullptr;
+    const char *gccname = getfileName(gcc.c_str());
+    static const char *_variant;
+
+    /*
+     * Debian's mingw-w64 ships a posix and a win32 thread model
+     * variant of every gcc version, the alternatives symlink
+     * tells which one is in use
+     */
+
+    if (const char *p = std::strrchr(gccname, '-'))
+    {
+        if (!std::strcmp(p, "-posix") || !std::strcmp(p, "-win32"))
+            variant = p;
+    }
+
+    _variant = variant.c_str();
+
+    auto checklibgcc = [](int dirfd, const char *version, unsigned char type)
+    {
+        static std::string file;
+        size_t len = std::strlen(version);
+        size_t variantlen = std::strlen(_variant);
+
+        if (len < variantlen || std::strcmp(version+len-variantlen, _variant) ||
+            !maybedirectory(type))
+        {
+            return false;
+        }
+
+        file = version;
+        file += "/libgcc.a";
+
+        return fileexistsat(dirfd, file.c_str());
+    };
+
+    dir = cmdargs.mingwbinpath;
+    dir += "/../lib/gcc/";
+    dir += cmdargs.target;
+    dir += "/";
+
+    if (!listfiles(dir.c_str(), &versions, checklibgcc))
+        return false;
+
+    for (const auto &version : versions)
+    {
+        compilerver cv = parsecompilerversion(version.c_str());
+
+        /*
+         * Prefer the version of the C++ headers,
+         * otherwise take the latest one
+         */
+
+        if (bestdir && best == cmdargs.mingwversion)
+            continue;
+
+        if (!bestdir || cv == cmdargs.mingwversion || cv > best)
+        {
+            best = cv;
+            bestdir = &version;
+        }
+    }
+
+    if (!bestdir)
+        return false;
+
+    cmdargs.libgccdir = dir + *bestdir;
+    return true;
+}
+
 static bool findstdheader(const char *target, commandargs &cmdargs)
 {
     std::string dir;
@@ -415,24 +523,21 @@ static bool findstdheader(const char *target, commandargs &cmdargs)
     {
         auto trydir = [&](const std::string &dir) -> bool
         {
-            if (!stat(dir.c_str(), &st) && S_ISDIR(st.st_mode))
-            {
-                std::string filecheck = dir + "/stdlib.h";
+            /* fails as well if dir is missing or not a directory */
+            std::string filecheck = dir + "/stdlib.h";
 
-                if (stat(filecheck.c_str(), &st))
-                    return false;
+            ++statcalls;
+            if (stat(filecheck.c_str(), &st))
+                return false;
 
-                stdpaths.push_back(dir);
+            stdpaths.push_back(dir);
 
 #ifdef _DEBUG
-                for (const auto &dir : stdpaths)
-                    std::cout << "found C include dir: " << dir << std::endl;
+            for (const auto &dir : stdpaths)
+                std::cout << "found C include dir: " << dir << std::endl;
 #endif
 
-                return true;
-            }
-
-            return false;
+            return true;
         };
 
         dir = stdinclude;
@@ -502,18 +607,10 @@ static bool findstdheader(const char *target, commandargs &cmdargs)
     return false;
 }
 
-static const char *findtarget32(commandargs &cmdargs)
-{
-    for (const char *target : TARGET32)
-        if (findstdheader(target, cmdargs)) return target;
-
-    return nullptr;
-}
-
-static const char *findtarget64(commandargs &cmdargs)
+static const char *findtarget(commandargs &cmdargs, int targettype)
 {
-    for (const char *target : TARGET64)
-        if (findstdheader(target, cmdargs)) return target;
+    for (const tripleinfo &triple : TRIPLES)
+        if (triple.type == targettype && findstdheader(triple.name, cmdargs)) return triple.name;
 
     return nullptr;
 }
@@ -531,28 +628,16 @@ static const char *findtriple(const char *name, int &targettype)
     if (!p)
         return nullptr;
 
-    for (const char *target : TARGET32)
-    {
-        if (!std::strncmp(target, name, len) && !target[len])
-        {
-            targettype = TARGET_WIN32;
-            return target;
-        }
-    }
+    const tripleinfo *triple = tablelookup(TRIPLES, TRIPLEINDEX, name, len);
 
-    for (const char *target : TARGET64)
-    {
-        if (!std::strncmp(target, name, len) && !target[len])
-        {
-            targettype = TARGET_WIN64;
-            return target;
-        }
-    }
+    if (!triple)
+        return nullptr;
 
-    return nullptr;
+    targettype = triple->type;
+    return triple->name;
 }
 
-void appendexetooutputname(char **cargs)
+void appendexetooutputname(char **cargs, stringarena &arena)
 {
     const char *filename;
     const char *suffix;
@@ -589,19 +674,8 @@ void appendexetooutputname(char **cargs)
             std::cerr << R"(wclang: appending ".exe" to output filename ")"
                       << filename << R"(")" << std::endl;
 
-            filename = nullptr;
-            suffix = nullptr;
-
-            const size_t len = std::strlen(*arg)+STRLEN(".exe")+1;
-            *arg = static_cast<char*>(std::realloc(*arg, len));
-
-            if (!*arg)
-            {
-                std::cerr << "out of memory" << std::endl;
-                std::exit(EXIT_FAILURE);
-            }
-
-            std::strcat(*arg, ".exe");
+            /* the argument may point into argv, don't touch it */
+            *arg = arena.concat(*arg, ".exe");
             break;
         }
         else if (!std::strcmp(*arg, "-c")) {
@@ -697,32 +771,54 @@ compilerver findlatestcompilerversion(const char *dir, listfilescallback cmp)
 bool fileexists(const char *file)
 {
     struct stat st;
+    ++statcalls;
     return !stat(file, &st);
 }
 
-bool isdirectory(const char *file, const char *prefix)
+bool fileexistsat(int dirfd, const char *file)
 {
     struct stat st;
+    ++statcalls;
+    return !fstatat(dirfd, file, &st, 0);
+}
 
-    if (prefix)
-    {
-        std::string tmp = prefix;
-        tmp += "/";
-        tmp += file;
-        return !stat(tmp.c_str(), &st) && S_ISDIR(st.st_mode);
-    }
+bool maybedirectory(unsigned char type)
+{
+#ifdef DT_DIR
+    /* symbolic links may point to a directory */
+    return type == DT_UNKNOWN || type == DT_DIR || type == DT_LNK;
+#else
+    return true;
+#endif
+}
 
-    return !stat(file, &st) && S_ISDIR(st.st_mode);
+static string_vector *listeddirs = nullptr;
+
+void recordlisteddirs(string_vector *dirs)
+{
+    listeddirs = dirs;
 }
 
 bool listfiles(const char *dir, std::vector<std::string> *files,
                listfilescallback cmp)
 {
-    DIR *d = opendir(dir);
+    ++opendircalls;
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *d;
     dirent *de;
 
-    if (!d)
+    if (fd == -1)
+        return false;
+
+    if (!(d = fdopendir(fd)))
+    {
+        close(fd);
         return false;
+    }
+
+    if (listeddirs)
+        listeddirs->push_back(dir);
 
     if (files)
         files->clear();
@@ -732,7 +828,13 @@ bool listfiles(const char *dir, std::vector<std::string> *files,
         if (de->d_name[0] == '.' || !std::strcmp(de->d_name, ".."))
             continue;
 
-        if ((!cmp || cmp(dir, de->d_name)) && files)
+#ifdef DT_DIR
+        unsigned char type = de->d_type;
+#else
+        unsigned char type = 0;
+#endif
+
+        if ((!cmp || cmp(fd, de->d_name, type)) && files)
             files->push_back(de->d_name);
     }
 
@@ -773,6 +875,7 @@ bool wcrealpath(const char *file, std::string &result,
         result += "/";
         result += file;
 
+        ++statcalls;
         if (!stat(result.c_str(), &st))
         {
             if (maxSymbolicLinkDepth == 0)
@@ -780,6 +883,8 @@ bool wcrealpath(const char *file, std::string &result,
 
             char buf[PATH_MAX + 1];
 
+            ++realpathcalls;
+
             if (realpath(result.c_str(), buf))
             {
                 result.assign(buf);
@@ -798,8 +903,13 @@ bool wcrealpath(const char *file, std::string &result,
         
                 memcpy(path, result.c_str(), pathlen); // not null terminated
 
-                while ((len = readlink(result.c_str(), buf, PATH_MAX)) != -1)
+                for (;;)
                 {
+                    ++readlinkcalls;
+
+                    if ((len = readlink(result.c_str(), buf, PATH_MAX)) == -1)
+                        break;
+
                     if (buf[0] != PATHDIV)
                     {
                         result.assign(path, pathlen);
@@ -831,12 +941,15 @@ bool wcrealpath(const char *file, std::string &result,
     return !result.empty();
 }
 
-bool getpathofcommand(const char *command, std::string &result)
+bool getpathofcommand(const char *command, std::string &result, std::string *file)
 {
     wcrealpath(command, result, [](const char *f, const struct stat&){
         return !access(f, F_OK|X_OK);
     }, ignoreccache);
 
+    if (file)
+        *file = result;
+
     size_t pos = result.find_last_of("/");
 
     if (pos != std::string::npos)
@@ -853,6 +966,8 @@ int runcommand(const char *command, char *buf, size_t len)
     FILE *p;
     size_t outputlen;
 
+    ++execcalls;
+
     if (!(p = popen(command, "r")) || !(outputlen = fread(buf, sizeof(char), len - 1, p)))
     {
         if (p) pclose(p);
@@ -863,12 +978,181 @@ int runcommand(const char *command, char *buf, size_t len)
     return pclose(p);
 }
 
+int runprocess(char *const *args, std::string *out, std::string *err)
+{
+    int outpipe[2] = { -1, -1 };
+    int errpipe[2] = { -1, -1 };
+    int status;
+    pid_t pid;
+
+    if ((out && pipe(outpipe)) || (err && pipe(errpipe)))
+        return RUNCOMMAND_ERROR;
+
+    ++execcalls;
+
+    if ((pid = fork()) == -1)
+        return RUNCOMMAND_ERROR;
+
+    if (!pid)
+    {
+        if (out) dup2(outpipe[1], STDOUT_FILENO);
+        if (err) dup2(errpipe[1], STDERR_FILENO);
+
+        for (int fd : { outpipe[0], outpipe[1], errpipe[0], errpipe[1] })
+            if (fd != -1) close(fd);
+
+        args = useresponsefile(args);
+        execvp(args[0], args);
+        _exit(127);
+    }
+
+    if (out) close(outpipe[1]);
+    if (err) close(errpipe[1]);
+
+    struct pollfd fds[2];
+    std::string *bufs[2];
+    nfds_t nfds = 0;
+
+    if (out) { fds[nfds].fd = outpipe[0]; bufs[nfds++] = out; }
+    if (err) { fds[nfds].fd = errpipe[0]; bufs[nfds++] = err; }
+
+    while (nfds)
+    {
+        char buf[65536];
+
+        for (nfds_t i = 0; i < nfds; ++i)
+            fds[i].events = POLLIN;
+
+        if (poll(fds, nfds, -1) == -1)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (nfds_t i = 0; i < nfds; ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+
+            if (n > 0)
+            {
+                bufs[i]->append(buf, n);
+                continue;
+            }
+
+            if (n == -1 && errno == EINTR)
+                continue;
+
+            /* EOF */
+            close(fds[i].fd);
+            fds[i] = fds[nfds-1];
+            bufs[i] = bufs[nfds-1];
+            --nfds;
+            break;
+        }
+    }
+
+    for (nfds_t i = 0; i < nfds; ++i)
+        close(fds[i].fd);
+
+    while (waitpid(pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+            return RUNCOMMAND_ERROR;
+    }
+
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+
+    return 128 + WTERMSIG(status);
+}
+
 void stripfilename(char *path)
 {
     char *p = strrchr(path, '/');
     if (*p) *p = '\0';
 }
 
+std::string jsonescape(const std::string &str)
+{
+    static constexpr char HEX[] = "0123456789abcdef";
+    std::string escaped;
+
+    for (char c : str)
+    {
+        unsigned char uc = static_cast<unsigned char>(c);
+
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        else if (uc < 0x20)
+        {
+            escaped += "\\u00";
+            escaped += HEX[uc >> 4];
+            escaped += HEX[uc & 0xf];
+            continue;
+        }
+
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+char *stringarena::alloc(size_t len)
+{
+    if (len > BLOCKSIZE)
+    {
+        large.emplace_back(new char[len]);
+        return large.back().get();
+    }
+
+    if (blocks.empty() || used + len > BLOCKSIZE)
+    {
+        if (blocks.empty() || ++current == blocks.size())
+        {
+            blocks.emplace_back(new char[BLOCKSIZE]);
+            current = blocks.size()-1;
+        }
+
+        used = 0;
+    }
+
+    char *p = blocks[current].get() + used;
+    used += len;
+    return p;
+}
+
+char *stringarena::copy(const char *str, size_t len)
+{
+    char *p = alloc(len+1);
+    std::memcpy(p, str, len);
+    p[len] = '\0';
+    return p;
+}
+
+char *stringarena::concat(const char *str1, const char *str2)
+{
+    size_t len1 = std::strlen(str1);
+    size_t len2 = std::strlen(str2);
+    char *p = alloc(len1+len2+1);
+
+    std::memcpy(p, str1, len1);
+    std::memcpy(p+len1, str2, len2+1);
+    return p;
+}
+
+void stringarena::reset()
+{
+    /* keep the blocks for the next use */
+    large.clear();
+    current = 0;
+    used = 0;
+}
+
 template<class... T>
 static void envvar(string_vector &env, const char *varname,
                    const char *val, T... values)
@@ -950,6 +1234,7 @@ static void warn(const char *str)
 
 static time_vector times;
 static time_point start = getticks();
+static bool clangtimetrace = false;
 
 static void timepoint(const char *description)
 {
@@ -981,354 +1266,460 @@ static void parseargs(int argc, char **argv, const char *target,
     for (int i = 0; i < argc; ++i)
     {
         char *arg = argv[i];
+        const char *value;
 
         if (*arg != '-')
             continue;
 
-        switch (*(arg+1))
+        /*
+         * Everything with COMMANDPREFIX belongs to us
+         */
+
+        if (arg[1] == '-' && !std::strncmp(arg+1, COMMANDPREFIX, STRLEN(COMMANDPREFIX)))
+            ++arg;
+
+        const optioninfo *opt = findoption(arg, &value);
+
+        if (!opt)
+        {
+            if (!std::strncmp(arg, COMMANDPREFIX, STRLEN(COMMANDPREFIX)))
+                goto invalid_argument;
+
+            continue;
+        }
+
+        if ((opt->flags & OPT_SEPARATE) && !*value)
         {
-            case 'c':
+            if (i+1 >= argc)
             {
-                if (!std::strcmp(arg, "-c") || !std::strcmp(arg, "-S"))
-                {
-                    cmdargs.iscompilestep = true;
-                    continue;
-                }
-                break;
+                if (opt->id == optionid::language)
+                    ERROR("missing argument for '-x'");
+
+                continue;
+            }
+
+            value = argv[++i];
+        }
+
+        switch (opt->id)
+        {
+            case optionid::compile:
+            {
+                cmdargs.iscompilestep = true;
+                continue;
             }
-            case 'f':
+            case optionid::exceptions:
+            case optionid::noexceptions:
             {
                 if (cmdargs.iscxx)
-                {
-                    if (!std::strcmp(arg, "-fexceptions"))
-                    {
-                        cmdargs.exceptions = 1;
-                        continue;
-                    }
-                    else if (!std::strcmp(arg, "-fno-exceptions"))
-                    {
-                        cmdargs.exceptions = 0;
-                        continue;
-                    }
-                }
-                break;
+                    cmdargs.exceptions = opt->id == optionid::exceptions;
+                continue;
             }
-            case 'm':
+            case optionid::mwindows:
+            case optionid::mdll:
+            case optionid::mconsole:
             {
-                if (!std::strcmp(arg, "-mwindows") && cmdargs.usemingwlinker == subsystem::standard)
-                {
-                    /*
-                     * Clang doesn't support -mwindows (yet)
-                     */
+                /*
+                 * Clang doesn't support -mwindows, -mdll and -mconsole (yet)
+                 */
 
-                    cmdargs.usemingwlinker = subsystem::windows;
-                    continue;
-                }
-                else if (!std::strcmp(arg, "-mdll") && cmdargs.usemingwlinker == subsystem::standard)
+                if (cmdargs.usemingwlinker == subsystem::standard)
                 {
-                    /*
-                     * Clang doesn't support -mdll (yet)
-                     */
-
-                    cmdargs.usemingwlinker = subsystem::dll;
-                    continue;
+                    if (opt->id == optionid::mwindows) cmdargs.usemingwlinker = subsystem::windows;
+                    else if (opt->id == optionid::mdll) cmdargs.usemingwlinker = subsystem::dll;
+                    else cmdargs.usemingwlinker = subsystem::console;
                 }
-                else if (!std::strcmp(arg, "-mconsole") && cmdargs.usemingwlinker == subsystem::standard)
+                continue;
+            }
+            case optionid::output:
+            {
+                cmdargs.islinkstep = true;
+                continue;
+            }
+            case optionid::shared:
+            {
+                cmdargs.isshared = true;
+                continue;
+            }
+            case optionid::language:
+            {
+                /*
+                 * The C++ headers have been looked up already
+                 * by findtoolchain() (or loaded from the cache)
+                 */
+                auto checkcxx = [&]()
                 {
-                    /*
-                     * Clang doesn't support -mconsole (yet)
-                     */
+                    cmdargs.iscxx = true;
+                };
+
+                if (!std::strcmp(value, "c")) cmdargs.iscxx = false;
+                else if (!std::strcmp(value, "c-header")) cmdargs.iscxx = false;
+                else if (!std::strcmp(value, "c++")) checkcxx();
+                else if (!std::strcmp(value, "c++-header")) checkcxx();
+                else ERROR("given language not supported");
+                continue;
+            }
+            case optionid::optimize:
+            {
+                int &level = cmdargs.optimizationlevel;
 
-                    cmdargs.usemingwlinker = subsystem::console;
-                    continue;
+                if (*value == 's') level = optimize::SIZE_1;
+                else if (*value == 'z') level = optimize::SIZE_2;
+                else if (!strcmp(value, "fast")) level = optimize::FAST;
+                else {
+                    level = std::atoi(value);
+                    if (level > optimize::LEVEL_3) level = optimize::LEVEL_3;
+                    else if (level < optimize::LEVEL_0) level = optimize::LEVEL_0;
                 }
-                break;
+                continue;
             }
-            case 'o':
+            case optionid::wc_arch:
             {
-                if (!std::strncmp(arg, "-o", STRLEN("-o")))
+                const char *end = std::strchr(target, '-');
+
+                if (!end)
                 {
-                    cmdargs.islinkstep = true;
-                    continue;
+                    std::cerr << "internal error (could not determine arch)"
+                              << std::endl;
+                    std::exit(EXIT_FAILURE);
                 }
-                break;
+
+                std::string arch(target, end-target);
+                std::cout << arch << std::endl;
+                std::exit(EXIT_SUCCESS);
             }
-            case 'x':
+            case optionid::wc_append_exe:
             {
-                if (!std::strncmp(arg, "-x", STRLEN("-x")))
-                {
-                    const char *p = arg+STRLEN("-x");
+                cmdargs.appendexe = true;
+                continue;
+            }
+            case optionid::wc_auto_pch:
+            {
+                /* -wc-auto-pch[=<header>,<header>,...] */
+                cmdargs.settings.autopch = true;
 
-                    if (!*p)
-                    {
-                        p = argv[++i];
-
-                        if (i >= argc)
-                            ERROR("missing argument for '-x'");
-                    }
-
-                    auto checkcxx = [&]()
-                    {
-                        if (!cmdargs.iscxx)
-                        {
-                            cmdargs.iscxx = true;
-                            findcxxheaders(target, cmdargs);
-                        }
-                    };
+                if (*value)
+                    cmdargs.settings.autopchheaders = value;
 
-                    if (!std::strcmp(p, "c")) cmdargs.iscxx = false;
-                    else if (!std::strcmp(p, "c-header")) cmdargs.iscxx = false;
-                    else if (!std::strcmp(p, "c++")) checkcxx();
-                    else if (!std::strcmp(p, "c++-header")) checkcxx();
-                    else ERROR("given language not supported");
-                    continue;
-                }
-                break;
+                continue;
             }
-            case 'O':
+            case optionid::wc_batch:
             {
-                if (!std::strncmp(arg, "-O", STRLEN("-O")))
-                {
-                    int &level = cmdargs.optimizationlevel;
-
-                    arg += STRLEN("-O");
-
-                    if (*arg == 's') level = optimize::SIZE_1;
-                    else if (*arg == 'z') level = optimize::SIZE_2;
-                    else if (!strcmp(arg, "fast")) level = optimize::FAST;
-                    else {
-                        level = std::atoi(arg);
-                        if (level > optimize::LEVEL_3) level = optimize::LEVEL_3;
-                        else if (level < optimize::LEVEL_0) level = optimize::LEVEL_0;
-                    }
-                    continue;
-                }
-                break;
+                /* handled in main() already */
+                continue;
             }
-            break;
-        }
+            case optionid::wc_cache:
+            {
+                cmdargs.settings.objectcache = true;
+                continue;
+            }
+            case optionid::wc_cache_stats:
+            {
+                printobjectcachestats();
+                std::exit(EXIT_SUCCESS);
+            }
+            case optionid::wc_env_var:
+            {
+                char *name = arg + (value-arg);
+                bool found = false;
 
-        /*
-         * Everything with COMMANDPREFIX belongs to us
-         */
+                for (char *p = name; *p; ++p) *p = toupper(*p);
 
-        if (!std::strncmp(arg, "--", STRLEN("--")))
-            ++arg;
+                size_t i = 0;
+                for (const char *var : ENVVARS)
+                {
+                    if (!std::strcmp(name, var))
+                    {
+                        const char *val = env[i].c_str();
+                        val += std::strlen(var) + 1; /* skip variable name */
 
-        if (std::strncmp(arg, COMMANDPREFIX, STRLEN(COMMANDPREFIX)))
-            continue;
+                        std::cout << val << std::endl;
+                        found = true;
 
-        arg += STRLEN(COMMANDPREFIX);
+                        break;
+                    }
 
-        #define INVALID_ARGUMENT else goto invalid_argument
+                    ++i;
+                }
 
-        switch (*arg)
-        {
-            case 'a':
-            {
-                if (!std::strcmp(arg, "arch") || !std::strcmp(arg, "a"))
+                if (!found)
                 {
-                    const char *end = std::strchr(target, '-');
+                    std::cerr << "environment variable " << name << " not found"
+                              << std::endl
+                              << "available environment variables: "
+                              << std::endl;
 
-                    if (!end)
-                    {
-                        std::cerr << "internal error (could not determine arch)"
-                                  << std::endl;
-                        std::exit(EXIT_FAILURE);
-                    }
+                    for (const char *var : ENVVARS)
+                        std::cerr << " " << var << std::endl;
 
-                    std::string arch(target, end-target);
-                    std::cout << arch << std::endl;
-                    std::exit(EXIT_SUCCESS);
+                    std::exit(EXIT_FAILURE);
                 }
-                else if (!std::strcmp(arg, "append-exe")) {
-                    cmdargs.appendexe = true;
-                } INVALID_ARGUMENT;
-                break;
+                std::exit(EXIT_SUCCESS);
             }
-            case 'e':
+            case optionid::wc_env:
             {
-                if (!std::strncmp(arg, "env-", STRLEN("env-")) ||
-                    !std::strncmp(arg, "e-", STRLEN("e-")))
-                {
-                    bool found = false;
-
-                    while (*++arg != '-');
-                    ++arg;
-
-                    for (char *p = arg; *p; ++p) *p = toupper(*p);
-
-                    size_t i = 0;
-                    for (const char *var : ENVVARS)
-                    {
-                        if (!std::strcmp(arg, var))
-                        {
-                            const char *val = env[i].c_str();
-                            val += std::strlen(var) + 1; /* skip variable name */
+                for (const auto &v : env) std::cout << v << " ";
+                std::cout << std::endl;
+                std::exit(EXIT_SUCCESS);
+            }
+            case optionid::wc_compdb:
+            {
+                std::string db = value;
+                char cwd[PATH_MAX];
 
-                            std::cout << val << std::endl;
-                            found = true;
+                if (db[0] != '/' && getcwd(cwd, sizeof(cwd)))
+                    db = std::string(cwd) + "/" + db;
 
-                            break;
-                        }
+                cmdargs.settings.compdb = db;
+                continue;
+            }
+            case optionid::wc_compdb_compact:
+            {
+                /* handled in main() already */
+                continue;
+            }
+            case optionid::wc_distribute:
+            {
+                /*
+                 * -wc-distribute=<worker>,...
+                 */
 
-                        if (found) break;
+                if (*value)
+                    cmdargs.settings.workers = value;
 
-                        ++i;
-                    }
+                cmdargs.settings.distribute = true;
+                continue;
+            }
+            case optionid::wc_fail_fast:
+            {
+                cmdargs.settings.failfast = true;
+                continue;
+            }
+            case optionid::wc_case_insensitive:
+            {
+                cmdargs.settings.caseinsensitive = true;
+                continue;
+            }
+            case optionid::wc_header_map:
+            {
+                cmdargs.settings.headermap = true;
+                continue;
+            }
+            case optionid::wc_import:
+            {
+                /* handled in buildcommand() */
+                continue;
+            }
+            case optionid::wc_modules:
+            {
+                /* -wc-modules[=<header>,<header>,...] */
+                cmdargs.settings.modules = true;
 
-                    if (!found)
-                    {
-                        std::cerr << "environment variable " << arg << " not found"
-                                  << std::endl
-                                  << "available environment variables: "
-                                  << std::endl;
+                if (*value)
+                    cmdargs.settings.modulesheaders = value;
 
-                        for (const char *var : ENVVARS)
-                            std::cerr << " " << var << std::endl;
+                continue;
+            }
+            case optionid::wc_help:
+            {
+                printheader();
 
-                        std::exit(EXIT_FAILURE);
-                    }
-                    std::exit(EXIT_SUCCESS);
-                }
-                else if (!std::strcmp(arg, "env") || !std::strcmp(arg, "e"))
+                auto printcmdhelp = [&](const char *cmd, const std::string &text)
                 {
-                    for (const auto &v : env) std::cout << v << " ";
-                    std::cout << std::endl;
-                    std::exit(EXIT_SUCCESS);
-                } INVALID_ARGUMENT;
-                break;
+                    std::cout << " " << COMMANDPREFIX << cmd << ": " << text << std::endl;
+                };
+
+                printcmdhelp("version", "show version");
+                printcmdhelp("target", "show target");
+
+                printcmdhelp("env-<var>", std::string("show environment variable  [e.g.: ") +
+                             std::string(COMMANDPREFIX) + std::string("env-ld]"));
+
+                printcmdhelp("env", "show all environment variables at once");
+                printcmdhelp("arch", "show target architecture");
+                printcmdhelp("static-runtime", "link runtime statically");
+                printcmdhelp("append-exe", "append .exe automatically to output filenames");
+                printcmdhelp("auto-pch[=<headers>]", "precompile the leading system headers "
+                             "[WCLANG_AUTO_PCH=1]");
+                printcmdhelp("use-mingw-linker", "link with mingw");
+                printcmdhelp("linker=<lld|default>", "link with the ld.lld next to clang "
+                             "[WCLANG_LINKER=lld]");
+                printcmdhelp("thinlto", "ThinLTO with a backend cache, links with lld "
+                             "[WCLANG_THINLTO=1]");
+                printcmdhelp("link-threads=<n>", "number of lld threads (default: job "
+                             "slots left by make or one per cpu) [WCLANG_LINK_THREADS=<n>]");
+                printcmdhelp("no-intrin", "do not use clang intrinsics");
+                printcmdhelp("verbose", "enable verbose messages");
+                printcmdhelp("cache", "cache compiled objects [WCLANG_CACHE=1]");
+                printcmdhelp("cache-stats", "show object cache statistics");
+                printcmdhelp("case-insensitive", "find system headers regardless of "
+                             "case (<Windows.h>) [WCLANG_CASE_INSENSITIVE=1]");
+                printcmdhelp("header-map", "look up the system headers in a generated "
+                             "header map [WCLANG_HEADER_MAP=1]");
+                printcmdhelp("import=<file.def>", "link against the import library "
+                             "of <file.def> (also for .def inputs without -shared)");
+                printcmdhelp("modules[=<headers>]", "import the system headers as clang "
+                             "modules (default: windows.h) [WCLANG_MODULES=1]");
+                printcmdhelp("jobs[=<n>]", "compile multiple source files in parallel "
+                             "[WCLANG_JOBS=<n>]");
+                printcmdhelp("trace=<file>", "write a chrome trace of all phases "
+                             "[WCLANG_TRACE=<file>]");
+                printcmdhelp("compdb=<file>", "record the compile commands for "
+                             "compile_commands.json [WCLANG_COMPDB=<file>]");
+                printcmdhelp("compdb-compact[=<file>]", "merge the recorded commands "
+                             "into <file>");
+                printcmdhelp("distribute[=<workers>]", "compile on wclang-worker hosts "
+                             "[WCLANG_DISTRIBUTE=1, WCLANG_WORKERS=<workers>]");
+                printcmdhelp("targets=<win32,win64,...>", "build for several targets "
+                             "at once, foo.o becomes foo.<target>.o");
+                printcmdhelp("batch=<file|->", "run the jobs listed in <file>, one "
+                             "'<directory> <arguments>' per line");
+                printcmdhelp("fail-fast", "cancel the remaining jobs after an error "
+                             "[WCLANG_FAIL_FAST=1]");
+
+                std::exit(EXIT_SUCCESS);
             }
-            case 'h':
+            case optionid::wc_jobs:
             {
-                if (!std::strcmp(arg, "help") || !std::strcmp(arg, "h"))
-                {
-                    printheader();
-
-                    auto printcmdhelp = [&](const char *cmd, const std::string &text)
-                    {
-                        std::cout << " " << COMMANDPREFIX << cmd << ": " << text << std::endl;
-                    };
-
-                    printcmdhelp("version", "show version");
-                    printcmdhelp("target", "show target");
+                /*
+                 * -wc-jobs: one job per cpu
+                 */
 
-                    printcmdhelp("env-<var>", std::string("show environment variable  [e.g.: ") +
-                                 std::string(COMMANDPREFIX) + std::string("env-ld]"));
+                long jobs = *value ? std::atol(value) : sysconf(_SC_NPROCESSORS_ONLN);
 
-                    printcmdhelp("env", "show all environment variables at once");
-                    printcmdhelp("arch", "show target architecture");
-                    printcmdhelp("static-runtime", "link runtime statically");
-                    printcmdhelp("append-exe", "append .exe automatically to output filenames");
-                    printcmdhelp("use-mingw-linker", "link with mingw");
-                    printcmdhelp("no-intrin", "do not use clang intrinsics");
-                    printcmdhelp("verbose", "enable verbose messages");
+                if (jobs < 1)
+                {
+                    std::cerr << "invalid number of jobs: " << arg << std::endl;
+                    std::exit(EXIT_FAILURE);
+                }
 
-                    std::exit(EXIT_SUCCESS);
-                } INVALID_ARGUMENT;
-                break;
+                cmdargs.settings.jobs = jobs;
+                continue;
             }
-            case 'n':
+            case optionid::wc_linker:
             {
-                if (!std::strncmp(arg, "no-intrin", STRLEN("no-intrin")))
-                {
-                    cmdargs.nointrinsics = true;
-                    continue;
-                } INVALID_ARGUMENT;
-                break;
+                if (!std::strcmp(value, "lld")) cmdargs.uselld = true;
+                else if (!std::strcmp(value, "default")) cmdargs.uselld = false;
+                else goto invalid_argument;
+                continue;
             }
-            case 's':
+            case optionid::wc_link_threads:
             {
-                if (!std::strcmp(arg, "static-runtime"))
+                if (std::atol(value) < 1)
                 {
-                    static constexpr const char* GCCRUNTIME = "-static-libgcc";
-                    static constexpr const char* LIBSTDCXXRUNTIME = "-static-libstdc++";
+                    std::cerr << "invalid number of threads: " << arg << std::endl;
+                    std::exit(EXIT_FAILURE);
+                }
+
+                cmdargs.settings.linkthreads = std::atol(value);
+                continue;
+            }
+            case optionid::wc_thinlto:
+            {
+                cmdargs.thinlto = true;
+                continue;
+            }
+            case optionid::wc_no_intrin:
+            {
+                cmdargs.nointrinsics = true;
+                continue;
+            }
+            case optionid::wc_static_runtime:
+            {
+                static constexpr const char* GCCRUNTIME = "-static-libgcc";
+                static constexpr const char* LIBSTDCXXRUNTIME = "-static-libstdc++";
 
+                /*
+                 * Postpone execution to later
+                 * We don't know yet, if it is the link step or not
+                 */
+                auto staticruntime = [](commandargs &cmdargs, char *arg)
+                {
                     /*
-                     * Postpone execution to later
-                     * We don't know yet, if it is the link step or not
+                     * Avoid "argument unused during compilation: '...'"
                      */
-                    auto staticruntime = [](commandargs &cmdargs, char *arg)
+                    if (!cmdargs.islinkstep)
                     {
-                        /*
-                         * Avoid "argument unused during compilation: '...'"
-                         */
-                        if (!cmdargs.islinkstep)
-                        {
-                            if (cmdargs.verbose)
-                                verbosemsg("ignoring %", arg);
-                            return;
-                        }
+                        if (cmdargs.verbose)
+                            verbosemsg("ignoring %", arg);
+                        return;
+                    }
 
-                        if (cmdargs.iscxx)
-                        {
-                            cmdargs.cxxflags.push_back(GCCRUNTIME);
-                            cmdargs.cxxflags.push_back(LIBSTDCXXRUNTIME);
-                        }
-                        else {
-                            cmdargs.cflags.push_back(GCCRUNTIME);
-                        }
-                    };
+                    if (cmdargs.iscxx)
+                    {
+                        cmdargs.cxxflags.push_back(GCCRUNTIME);
+                        cmdargs.cxxflags.push_back(LIBSTDCXXRUNTIME);
+                    }
+                    else {
+                        cmdargs.cflags.push_back(GCCRUNTIME);
+                    }
+                };
 
-                    delayedcommands.push_back(dc_tuple(staticruntime, arg-STRLEN(COMMANDPREFIX)));
-                } INVALID_ARGUMENT;
-                break;
+                delayedcommands.push_back(dc_tuple(staticruntime, arg));
+                continue;
             }
-            case 't':
+            case optionid::wc_target:
             {
-                if (!std::strcmp(arg, "target") || !std::strcmp(arg, "t"))
-                {
-                    std::cout << target << std::endl;
-                    std::exit(EXIT_SUCCESS);
-                } INVALID_ARGUMENT;
-                break;
+                std::cout << target << std::endl;
+                std::exit(EXIT_SUCCESS);
+            }
+            case optionid::wc_targets:
+            case optionid::wc_trace:
+            {
+                /* handled in main() already */
+                continue;
             }
-            case 'u':
+            case optionid::wc_use_mingw_linker:
             {
-                if (!std::strcmp(arg, "use-mingw-linker"))
+                auto usemingwlinker = [](commandargs &cmdargs, char *arg)
                 {
-                    auto usemingwlinker = [](commandargs &cmdargs, char *arg)
+                    if (cmdargs.thinlto)
                     {
-                        if (!cmdargs.islinkstep)
-                        {
-                            if (cmdargs.verbose)
-                                verbosemsg("ignoring %", arg);
-                            return;
-                        }
+                        /* mingw ld cannot link the bitcode objects */
+                        std::cerr << "-wc-thinlto links with lld, it cannot be used with "
+                                  << arg << std::endl;
+                        std::exit(EXIT_FAILURE);
+                    }
 
-                        cmdargs.usemingwlinker = subsystem::use_mingw_linker;
-                    };
+                    if (!cmdargs.islinkstep)
+                    {
+                        if (cmdargs.verbose)
+                            verbosemsg("ignoring %", arg);
+                        return;
+                    }
 
-                    delayedcommands.push_back(dc_tuple(usemingwlinker, arg-STRLEN(COMMANDPREFIX)));
-                    continue;
-                } INVALID_ARGUMENT;
-                break;
+                    cmdargs.usemingwlinker = subsystem::use_mingw_linker;
+                };
+
+                delayedcommands.push_back(dc_tuple(usemingwlinker, arg));
+                continue;
             }
-            case 'v':
+            case optionid::wc_version:
             {
-                if (!std::strcmp(arg, "version") || !std::strcmp(arg, "v"))
-                {
-                    printheader();
-                    std::cout << "Copyright (C) 2013-2017 Thomas Poechtrager" << std::endl;
-                    std::cout << "License: GPL v2" << std::endl;
-                    std::cout << "Bugs / Wishes: " << PACKAGE_BUGREPORT << std::endl;
-                    std::exit(EXIT_SUCCESS);
-                }
-                else if (!std::strcmp(arg, "verbose")) {
-                    cmdargs.verbose = true;
-                } INVALID_ARGUMENT;
-                break;
+                printheader();
+                std::cout << "Copyright (C) 2013-2017 Thomas Poechtrager" << std::endl;
+                std::cout << "License: GPL v2" << std::endl;
+                std::cout << "Bugs / Wishes: " << PACKAGE_BUGREPORT << std::endl;
+                std::exit(EXIT_SUCCESS);
+            }
+            case optionid::wc_verbose:
+            {
+                cmdargs.verbose = true;
+                continue;
             }
             default:
             {
-                invalid_argument:;
-                printheader();
-                std::cerr << "invalid argument: " << COMMANDPREFIX << arg << std::endl;
-                std::exit(EXIT_FAILURE);
+                if (opt->flags & OPT_WCLANG)
+                    goto invalid_argument;
+
+                continue;
             }
         }
 
-        #undef INVALID_ARGUMENT
+        invalid_argument:;
+        printheader();
+        std::cerr << "invalid argument: " << arg << std::endl;
+        std::exit(EXIT_FAILURE);
     }
 
     if (cmdargs.islinkstep && cmdargs.iscompilestep)
@@ -1349,57 +1740,43 @@ static void parseargs(int argc, char **argv, const char *target,
     }
 }
 
-int main(int argc, char **argv)
+static void ignoremingwpath(commandargs &cmdargs)
 {
-    std::string target;
-    int targettype = -1;
-    const char *e = std::strrchr(argv[0], '/');
-    const char *p = nullptr;
-
-    bool iscxx = false;
-    string_vector intrinpaths;
-    string_vector stdpaths;
-    string_vector cxxpaths;
-    string_vector linkerflags;
-    std::string compiler;
-    std::string compilerpath;
-    std::string compilerbinpath;
-    string_vector env;
-    string_vector args;
-    char **cargs = nullptr;
-    int cargsi = 0;
-    string_vector cflags;
-    string_vector cxxflags;
-
-    commandargs cmdargs(intrinpaths, stdpaths, cxxpaths, cflags,
-                        cxxflags, linkerflags, target,
-                        compiler, compilerpath, compilerbinpath, env,
-                        args, iscxx);
+    warn("MINGW_PATH env variable does not point to any "
+         "valid mingw installation for the current target!");
 
-    timepoint("start");
+#ifdef HAVE_UNSETENV
+    unsetenv("MINGW_PATH");
+    cmdargs.invalidmingwpath = true;
+#else
+    std::exit(EXIT_FAILURE);
+#endif
+}
 
-    if (!e) e = argv[0];
-    else ++e;
+static void addmingwpath()
+{
+    const char *mingwpath = getenv("MINGW_PATH");
 
-    p = std::strrchr(e, '-');
-    if (!p++ || std::strncmp(p, "clang", STRLEN("clang")))
+    if (!mingwpath)
     {
-        std::cerr << "invalid invocation name: clang should be followed "
-                     "after target (e.g.: w32-clang)" << std::endl;
-        return 1;
+#ifdef MINGW_PATH
+        if (*MINGW_PATH) mingwpath = MINGW_PATH;
+#endif
     }
 
-    /*
-     * Check if we want the C or the C++ compiler
-     */
+    if (mingwpath && *mingwpath)
+        concatenvvariable("PATH", mingwpath);
+}
 
-    p += STRLEN("clang");
-    if (!std::strcmp(p, "++")) iscxx = true;
-    else if (*p) {
-        std::cerr << "invalid invocation name: ++ (or nothing) should be "
-                     "followed after clang (e.g.: w32-clang++)" << std::endl;
-        return 1;
-    }
+/*
+ * Lookup everything that only depends on the
+ * environment, the result is stored in the
+ * toolchain cache
+ */
+
+static int findtoolchain(const char *e, commandargs &cmdargs, int &targettype)
+{
+    std::string &target = cmdargs.target;
 
     /*
      * Check if we should target win32 or win64...
@@ -1407,6 +1784,8 @@ int main(int argc, char **argv)
 
     find_target_and_headers:;
 
+    tracespan targetspan("find target and headers");
+
     if (const char *triple = findtriple(e, targettype))
     {
         target = triple;
@@ -1416,18 +1795,20 @@ int main(int argc, char **argv)
     {
         if (!std::strncmp(e, "w32", STRLEN("w32")))
         {
-            const char *t = findtarget32(cmdargs);
+            const char *t = findtarget(cmdargs, TARGET_WIN32);
             target = t ? t : "";
             targettype = TARGET_WIN32;
         }
         else if (!std::strncmp(e, "w64", STRLEN("w64")))
         {
-            const char *t = findtarget64(cmdargs);
+            const char *t = findtarget(cmdargs, TARGET_WIN64);
             target = t ? t : "";
             targettype = TARGET_WIN64;
         }
     }
 
+    targetspan.end();
+
     if (targettype == -1)
     {
         std::cerr << "invalid target: " << e << std::endl;
@@ -1440,15 +1821,7 @@ int main(int argc, char **argv)
 
         if (getenv("MINGW_PATH"))
         {
-            warn("MINGW_PATH env variable does not point to any "
-                 "valid mingw installation for the current target!");
-
-#ifdef HAVE_UNSETENV
-            unsetenv("MINGW_PATH");
-#else
-            std::exit(EXIT_FAILURE);
-#endif
-
+            ignoremingwpath(cmdargs);
             goto find_target_and_headers;
         }
 
@@ -1474,7 +1847,7 @@ int main(int argc, char **argv)
      * Lookup C and C++ include paths
      */
 
-    if (stdpaths.empty())
+    if (cmdargs.stdpaths.empty())
     {
         std::cerr << "cannot find " << target
                   << " C headers" << std::endl;
@@ -1484,7 +1857,11 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if (!findcxxheaders(target.c_str(), cmdargs) && iscxx)
+    tracespan cxxspan("findcxxheaders");
+    cmdargs.havecxxheaders = findcxxheaders(target.c_str(), cmdargs);
+    cxxspan.end();
+
+    if (!cmdargs.havecxxheaders && cmdargs.iscxx)
     {
         std::cerr << "cannot find " << target
                   << " C++ headers" << std::endl;
@@ -1496,56 +1873,334 @@ int main(int argc, char **argv)
     }
 
     /*
-     * Setup compiler command
+     * Find clang, it is not needed with -wc-use-mingw-linker,
+     * so don't error out here
      */
 
-    if (iscxx)
-    {
-        compiler = "clang++";
+    tracespan clangspan("find clang and intrinsics");
 
-        if (STRLEN(CXXFLAGS) > 0)
-            cxxflags.push_back(CXXFLAGS);
-    }
-    else
+    if (getpathofcommand(cmdargs.iscxx ? "clang++" : "clang", cmdargs.compilerbinpath))
     {
-        compiler = "clang";
+        cmdargs.haveintrinsics = findintrinheaders(cmdargs, cmdargs.compilerbinpath);
 
-        if (STRLEN(CFLAGS) > 0)
-            cflags.push_back(CFLAGS);
+        /* clang finds its own ld.lld first (-wc-linker=lld) */
+        cmdargs.havelld = fileexists((cmdargs.compilerbinpath + "/ld.lld").c_str());
     }
 
+    clangspan.end();
+
     /*
-     * Setup environment variables
+     * Find MinGW binaries (required for linking)
      */
 
-    for (const char *var : ENVVARS)
+    addmingwpath();
+
+    std::string gcc = target + (cmdargs.iscxx ? "-g++" : "-gcc");
+    std::string gccfile;
+    tracespan gccspan("find mingw gcc");
+
+    if (!getpathofcommand(gcc.c_str(), cmdargs.mingwbinpath, &gccfile))
     {
-        size_t len = std::strlen(var);
-        char *buf = new char[1+len+1];
+        std::cerr << "cannot find " << gcc << " executable" << std::endl;
+        return 1;
+    }
 
-        buf[len+1] = '\0';
-        *buf++ = '-';
+    gccspan.end();
 
-        for (size_t i = 0; i < len; ++i)
-            buf[i] = tolower(var[i]);
+    /* https://github.com/tpoechtrager/wclang/issues/22 */
+    tracespan libgccspan("findlibgccdir");
+    findlibgccdir(cmdargs, gccfile);
 
-        envvar(env, var, target.c_str(), --buf);
-        delete[] buf;
-    }
+    return 0;
+}
 
-    /*
-     * Parse command arguments late,
-     * when we know our environment already
-     */
+/*
+ * The llvm tool next to clang, otherwise the mingw
+ * one of the environment (ENVVARS)
+ */
 
-    parseargs(argc, argv, target.c_str(), cmdargs, env); /* may not return */
+static bool getbinutil(const commandargs &cmdargs, const char *llvmtool,
+                       const char *var, std::string &tool)
+{
+    std::string name;
+    size_t len = std::strlen(var);
 
-    /*
-     * Setup compiler Arguments
-     */
+    tool = cmdargs.compilerbinpath + "/" + llvmtool;
 
-    if (cmdargs.islinkstep)
-    {
+    if (!cmdargs.compilerbinpath.empty() && fileexists(tool.c_str()))
+        return true;
+
+    for (const auto &v : cmdargs.env)
+    {
+        if (!v.compare(0, len, var) && v[len] == '=')
+            name = v.substr(len+1);
+    }
+
+    tool = cmdargs.mingwbinpath + "/" + name;
+
+    if (!name.empty() && !cmdargs.mingwbinpath.empty() && fileexists(tool.c_str()))
+        return true;
+
+    /* in PATH, not resolved: llvm tools look at their name */
+    if (!name.empty() && wcrealpath(name.c_str(), tool, nullptr, nullptr, 0))
+        return true;
+
+    std::cerr << "cannot find " << (name.empty() ? llvmtool : name.c_str())
+              << " executable" << std::endl;
+    return false;
+}
+
+/*
+ * Storage of the final compiler arguments and the
+ * settings to run them with, valid until the next
+ * buildcommand() call
+ */
+
+static std::vector<char*> cargsvector;
+static stringarena cargsarena;
+static buildsettings settings;
+
+/*
+ * Keep the toolchain in memory for the jobs
+ * forked by -wc-batch
+ */
+
+static bool pintoolchain = false;
+
+/*
+ * The jobs of -wc-batch start from the -wc-*
+ * settings of the batch invocation
+ */
+
+static bool batchjob = false;
+
+/*
+ * The WCLANG_* variables of the settings,
+ * overridden by the -wc-* options
+ */
+
+static void readsettings(commandargs &cmdargs)
+{
+    const char *p;
+
+    cmdargs.settings.autopch = (p = getenv("WCLANG_AUTO_PCH")) && *p == '1';
+    cmdargs.settings.objectcache = (p = getenv("WCLANG_CACHE")) && *p == '1';
+    cmdargs.settings.distribute = (p = getenv("WCLANG_DISTRIBUTE")) && *p == '1';
+    cmdargs.settings.failfast = (p = getenv("WCLANG_FAIL_FAST")) && *p == '1';
+    cmdargs.settings.caseinsensitive = (p = getenv("WCLANG_CASE_INSENSITIVE")) && *p == '1';
+    cmdargs.settings.headermap = (p = getenv("WCLANG_HEADER_MAP")) && *p == '1';
+    cmdargs.settings.modules = (p = getenv("WCLANG_MODULES")) && *p == '1';
+    cmdargs.settings.jobs = (p = getenv("WCLANG_JOBS")) ? std::atol(p) : 0;
+    cmdargs.settings.linkthreads = (p = getenv("WCLANG_LINK_THREADS")) ? std::atol(p) : 0;
+
+    if ((p = getenv("WCLANG_AUTO_PCH_HEADERS"))) cmdargs.settings.autopchheaders = p;
+    if ((p = getenv("WCLANG_COMPDB"))) cmdargs.settings.compdb = p;
+    if ((p = getenv("WCLANG_WORKERS"))) cmdargs.settings.workers = p;
+    if ((p = getenv("WCLANG_MODULES_HEADERS"))) cmdargs.settings.modulesheaders = p;
+}
+
+/*
+ * Builds the final compiler command,
+ * returns 0 on success or the exit code
+ */
+
+static int buildcommand(int argc, char **argv, std::string &compilerout, char **&cargsout)
+{
+    std::string target;
+    int targettype = -1;
+    const char *e = std::strrchr(argv[0], '/');
+    const char *p = nullptr;
+
+    bool iscxx = false;
+    string_vector intrinpaths;
+    string_vector stdpaths;
+    string_vector cxxpaths;
+    string_vector linkerflags;
+    std::string compiler;
+    std::string compilerpath;
+    std::string compilerbinpath;
+    string_vector env;
+    char **cargs = nullptr;
+    string_vector cflags;
+    string_vector cxxflags;
+
+    commandargs cmdargs(intrinpaths, stdpaths, cxxpaths, cflags,
+                        cxxflags, linkerflags, target,
+                        compiler, compilerpath, compilerbinpath, env,
+                        iscxx);
+
+    start = getticks(); /* wclangd forks us much later */
+    timepoint("start");
+
+    tracespan span("buildcommand");
+
+    if (!e) e = argv[0];
+    else ++e;
+
+    p = std::strrchr(e, '-');
+    if (!p++ || std::strncmp(p, "clang", STRLEN("clang")))
+    {
+        std::cerr << "invalid invocation name: clang should be followed "
+                     "after target (e.g.: w32-clang)" << std::endl;
+        return 1;
+    }
+
+    /*
+     * Check if we want the C or the C++ compiler
+     */
+
+    p += STRLEN("clang");
+    if (!std::strcmp(p, "++")) iscxx = true;
+    else if (*p) {
+        std::cerr << "invalid invocation name: ++ (or nothing) should be "
+                     "followed after clang (e.g.: w32-clang++)" << std::endl;
+        return 1;
+    }
+
+    /*
+     * Check if we should target win32 or win64
+     * and lookup the C and C++ include paths...
+     */
+
+    tracespan cachespan("toolchain cache lookup");
+    toolchaincache tccache(e);
+    bool cached = tccache.load(cmdargs, targettype);
+
+    if (!cached && tccache.lock())
+    {
+        /* someone else may have filled the cache while we were waiting */
+        cached = tccache.load(cmdargs, targettype);
+    }
+
+    cachespan.end();
+
+    if (cached)
+    {
+        if (cmdargs.invalidmingwpath)
+            ignoremingwpath(cmdargs);
+
+        addmingwpath();
+        timepoint("toolchain cache hit");
+    }
+    else
+    {
+        tracespan discoveryspan("toolchain discovery");
+        recordlisteddirs(&cmdargs.listeddirs);
+
+        if (int ret = findtoolchain(e, cmdargs, targettype))
+            return ret;
+
+        recordlisteddirs(nullptr);
+        tccache.store(cmdargs, targettype);
+        timepoint("toolchain discovery");
+    }
+
+    tccache.unlock();
+
+    if (pintoolchain)
+        tccache.pin();
+
+    /*
+     * Setup compiler command
+     */
+
+    if (iscxx)
+    {
+        compiler = "clang++";
+
+        if (STRLEN(CXXFLAGS) > 0)
+            cxxflags.push_back(CXXFLAGS);
+    }
+    else
+    {
+        compiler = "clang";
+
+        if (STRLEN(CFLAGS) > 0)
+            cflags.push_back(CFLAGS);
+    }
+
+    /*
+     * Setup environment variables
+     */
+
+    for (const char *var : ENVVARS)
+    {
+        size_t len = std::strlen(var);
+        char *buf = new char[1+len+1];
+
+        buf[len+1] = '\0';
+        *buf++ = '-';
+
+        for (size_t i = 0; i < len; ++i)
+            buf[i] = tolower(var[i]);
+
+        envvar(env, var, target.c_str(), --buf);
+        delete[] buf;
+    }
+
+    /*
+     * Parse command arguments late,
+     * when we know our environment already
+     */
+
+    if ((p = getenv("WCLANG_LINKER")) && !std::strcmp(p, "lld"))
+        cmdargs.uselld = true;
+
+    if ((p = getenv("WCLANG_THINLTO")) && *p == '1')
+        cmdargs.thinlto = true;
+
+    if (batchjob)
+        cmdargs.settings = settings;
+    else
+        readsettings(cmdargs);
+
+    tracespan parsespan("parseargs");
+    parseargs(argc, argv, target.c_str(), cmdargs, env); /* may not return */
+    parsespan.end();
+
+    /*
+     * The workers must run the same clang version (-wc-distribute)
+     */
+
+    cmdargs.settings.distributeclang.clear();
+
+    if (cmdargs.haveintrinsics && cmdargs.settings.distribute)
+        cmdargs.settings.distributeclang = cmdargs.clangversion.str();
+
+    tracespan assemblyspan("argument assembly");
+
+    /*
+     * Setup compiler Arguments
+     */
+
+    /*
+     * mingw ld cannot link LLVM bitcode, decided on every
+     * step so the objects always suit the link
+     */
+
+    if (cmdargs.thinlto && !cmdargs.havelld)
+    {
+        warn("-wc-thinlto: cannot find ld.lld in %, building without ThinLTO",
+             compilerbinpath.empty() ? "PATH" : compilerbinpath);
+        cmdargs.thinlto = false;
+    }
+
+    if (cmdargs.thinlto)
+        cmdargs.uselld = true;
+
+    if (!cmdargs.islinkstep || cmdargs.usemingwlinker == subsystem::use_mingw_linker)
+    {
+        cmdargs.uselld = false;
+    }
+    else if (cmdargs.uselld && !cmdargs.havelld)
+    {
+        warn("cannot find ld.lld in %, using the default linker",
+             compilerbinpath.empty() ? "PATH" : compilerbinpath);
+        cmdargs.uselld = false;
+    }
+
+    if (cmdargs.islinkstep)
+    {
         switch (cmdargs.usemingwlinker) {
             case subsystem::standard:
                 break;
@@ -1559,11 +2214,56 @@ int main(int argc, char **argv)
                 linkerflags.push_back("-Wl,--subsystem,windows");
                 break;
             case subsystem::dll:
-                linkerflags.push_back("-Wl,--subsystem,dll");
+                /* lld has no dll subsystem, it wants --dll */
+                linkerflags.push_back(cmdargs.uselld ? "-shared" : "-Wl,--subsystem,dll");
                 break;
         }
     }
 
+    /*
+     * lld uses all cpus by default, runcompiler() lowers the
+     * thread count to the job slots make has left
+     */
+
+    long linkthreads = cmdargs.settings.linkthreads;
+
+    if (linkthreads < 1)
+        linkthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cmdargs.uselld)
+    {
+        linkerflags.push_back("-fuse-ld=lld");
+
+        if (cmdargs.clangversion >= compilerver(11, 0, 0))
+            linkerflags.push_back(LLDTHREADSOPT + std::to_string(linkthreads));
+        else if (linkthreads == 1)
+            linkerflags.push_back("-Wl,--no-threads");
+    }
+
+    if (cmdargs.thinlto && (cmdargs.iscompilestep || cmdargs.islinkstep))
+    {
+        (iscxx ? cxxflags : cflags).push_back("-flto=thin");
+
+        /*
+         * Keep the backend objects of unchanged modules
+         * for the next link
+         */
+
+        std::string dir;
+
+        if (cmdargs.islinkstep && cmdargs.uselld && getthinltocachedir(target, dir))
+        {
+            tracespan prunespan("thinlto cache pruning");
+            prunethinltocache(dir);
+
+            if (cmdargs.clangversion >= compilerver(10, 0, 0))
+                linkerflags.push_back("-Wl,--thinlto-cache-dir=" + dir);
+
+            if (cmdargs.clangversion >= compilerver(12, 0, 0))
+                linkerflags.push_back(THINLTOJOBSOPT + std::to_string(linkthreads));
+        }
+    }
+
     if ((targettype == TARGET_WIN64) &&
         (cmdargs.iscompilestep || cmdargs.islinkstep) &&
         (cmdargs.optimizationlevel >= optimize::LEVEL_1))
@@ -1585,47 +2285,25 @@ int main(int argc, char **argv)
 
     if (compiler[0] != '/')
     {
-        std::string tmp;
+        /*
+         * Both paths have been looked up by findtoolchain() already
+         */
 
-        if (!getpathofcommand(compiler.c_str(), compilerbinpath))
+        const std::string &binpath =
+            (cmdargs.islinkstep && cmdargs.usemingwlinker == subsystem::use_mingw_linker)
+            ? cmdargs.mingwbinpath : compilerbinpath;
+
+        if (binpath.empty())
         {
             std::cerr << "cannot find '" << compiler << "' executable"
                       << std::endl;
             return 1;
         }
 
-        tmp.swap(compiler);
-
-        compiler = compilerbinpath;
-        compiler += "/";
-        compiler += tmp;
+        compiler = binpath + "/" + compiler;
     }
 
     {
-        /*
-         * Find MinGW binaries (required for linking)
-         */
-        std::string gcc = target + (iscxx ? "-g++" : "-gcc");
-        std::string path;
-
-        const char *mingwpath = getenv("MINGW_PATH");
-
-        if (!mingwpath)
-        {
-#ifdef MINGW_PATH
-            if (*MINGW_PATH) mingwpath = MINGW_PATH;
-#endif
-        }
-
-        if (mingwpath && *mingwpath)
-            concatenvvariable("PATH", mingwpath);
-
-        if (!getpathofcommand(gcc.c_str(), path))
-        {
-            std::cerr << "cannot find " << gcc << " executable" << std::endl;
-            return 1;
-        }
-
 #if 0
         /*
          * COMPILER_PATH would be a perfect solution to get rid of the
@@ -1633,60 +2311,96 @@ int main(int argc, char **argv)
          * to use the wrong assembler/linker on some systems.
          * GCC is invoked for assembling (prior to clang 3.5) and linking.
          */
-        concatenvvariable("COMPILER_PATH", path, &cmdargs.compilerpath);
+        concatenvvariable("COMPILER_PATH", cmdargs.mingwbinpath, &cmdargs.compilerpath);
 #endif
 
         if (cmdargs.islinkstep)
         {
             /* https://github.com/tpoechtrager/wclang/issues/22 */
 
-            std::string command = cmdargs.target + "-gcc -print-libgcc-file-name";
-            char output[4096];
+            tracespan libgccspan("libgcc lookup");
 
-            if (runcommand(command.c_str(), output, sizeof(output)) == 0)
+            if (cmdargs.libgccdir.empty())
             {
-                stripfilename(output);
-                linkerflags.push_back(std::string("-L") + output);
+                /*
+                 * Unknown mingw layout, ask gcc (the output is cached)
+                 */
+
+                std::string gcc = cmdargs.mingwbinpath + "/" + target + "-gcc";
+                std::string command = gcc + " -print-libgcc-file-name";
+                std::string output;
+
+                if (runcommandcached(command, gcc, output))
+                {
+                    size_t pos = output.find_last_of(PATHDIV);
+
+                    if (pos != std::string::npos)
+                        cmdargs.libgccdir = output.substr(0, pos);
+                }
             }
+
+            if (!cmdargs.libgccdir.empty())
+                linkerflags.push_back(std::string("-L") + cmdargs.libgccdir);
         }
 
 
-        args.push_back(compiler);
+        /*
+         * Arguments from argv and string literals are passed through
+         * as they are, everything else is copied into the arena
+         */
+
+        cargsarena.reset();
+        cargsvector.clear();
+        cargsvector.reserve(argc + cflags.size() + cxxflags.size() + linkerflags.size() +
+                            2*(intrinpaths.size() + cxxpaths.size() + stdpaths.size()) + 16);
+
+        auto pushstatic = [&](const char *arg)
+        {
+            cargsvector.push_back(const_cast<char*>(arg));
+        };
+
+        auto pushstring = [&](const std::string &arg)
+        {
+            cargsvector.push_back(cargsarena.copy(arg));
+        };
+
+        pushstring(compiler);
 
         auto pushcompilerflags = [&](const string_vector &flags)
         {
             for (const auto &flag : flags)
-                args.push_back(flag);
+                pushstring(flag);
         };
 
         pushcompilerflags(iscxx ? cxxflags : cflags);
         pushcompilerflags(linkerflags);
 
-        if (!cmdargs.islinkstep || cmdargs.usemingwlinker != subsystem::standard)
+        if (!cmdargs.islinkstep || cmdargs.usemingwlinker != subsystem::standard ||
+            cmdargs.uselld)
         {
             char *p;
 
-            args.push_back(CLANG_TARGET_OPT);
-            args.push_back(target);
+            pushstatic(CLANG_TARGET_OPT);
+            pushstring(target);
 
             /*
              * Prevent clang from including /usr/include in
              * case a file is not found in our directories
              */
-            args.push_back("-nostdinc");
-            args.push_back("-nostdinc++");
-            args.push_back("-Qunused-arguments");
+            pushstatic("-nostdinc");
+            pushstatic("-nostdinc++");
+            pushstatic("-Qunused-arguments");
 
             auto pushdirs = [&](const string_vector &paths)
             {
                 for (const auto &dir : paths)
                 {
-                    args.push_back("-isystem");
-                    args.push_back(dir);
+                    pushstatic("-isystem");
+                    pushstring(dir);
                 }
             };
 
-            if (!findintrinheaders(cmdargs, compilerbinpath))
+            if (!cmdargs.haveintrinsics)
             {
                 if (!cmdargs.nointrinsics)
                     warn("cannot find clang intrinsics directory");
@@ -1697,7 +2411,7 @@ int main(int argc, char **argv)
                  * Workaround for clang 3.5.0 to get rid of
                  * error: redeclaration of '_scanf_l' cannot add 'dllimport' attribute
                  */
-                args.push_back("-D_STDIO_S_DEFINED");
+                pushstatic("-D_STDIO_S_DEFINED");
             }
 
             if (cmdargs.verbose)
@@ -1718,7 +2432,7 @@ int main(int argc, char **argv)
                                   << "(env. variable) to force C++ exceptions" << std::endl;
                     }
 
-                    args.push_back("-fno-exceptions");
+                    pushstatic("-fno-exceptions");
                 }
                 else {
                     cmdargs.exceptions = -1;
@@ -1727,11 +2441,80 @@ int main(int argc, char **argv)
 
             if (targettype == TARGET_WIN32 && cmdargs.clangversion >= compilerver(6, 0, 0))
             {
-              args.push_back("-fsjlj-exceptions");
+              pushstatic("-fsjlj-exceptions");
             }
 
             if ((p = getenv("WCLANG_NO_INTEGRATED_AS")) && *p == '1')
-                args.push_back("-no-integrated-as");
+                pushstatic("-no-integrated-as");
+
+            /*
+             * Let clang add its own timeline to the trace,
+             * cache hits would not have one anyway
+             */
+
+            if (istraceenabled() && cmdargs.iscompilestep &&
+                cmdargs.clangversion >= compilerver(9, 0, 0) &&
+                !cmdargs.settings.objectcache)
+            {
+                pushstatic("-ftime-trace");
+                clangtimetrace = true;
+            }
+
+            std::string headermap;
+
+            if (cmdargs.settings.caseinsensitive || cmdargs.settings.headermap)
+            {
+                tracespan headermapspan("header map");
+
+                /* indexes the headers of the directories below */
+                if (getheadermap(cmdargs, headermap))
+                {
+                    pushstatic("-isystem");
+                    pushstring(headermap);
+                }
+            }
+
+            if (cmdargs.settings.caseinsensitive)
+            {
+                std::string overlay;
+                tracespan overlayspan("case-insensitive overlay");
+
+                /*
+                 * The header map ignores case as well, the overlay
+                 * covers the headers it leaves to the directories
+                 */
+
+                if (cmdargs.clangversion < compilerver(3, 5, 0))
+                {
+                    warn("-wc-case-insensitive needs clang 3.5 or later");
+                }
+                else if (getcaseinsensitiveoverlay(cmdargs, overlay))
+                {
+                    pushstatic("-ivfsoverlay");
+                    pushstring(overlay);
+                }
+            }
+
+            if (cmdargs.settings.modules)
+            {
+                std::string modulemap;
+                std::string modulecache;
+                tracespan modulesspan("module map");
+
+                if (cmdargs.clangversion < compilerver(3, 5, 0))
+                {
+                    warn("-wc-modules needs clang 3.5 or later");
+                }
+                else if (getmodulemap(cmdargs, modulemap, modulecache))
+                {
+                    pushstatic("-fmodules");
+                    pushstring("-fmodule-map-file=" + modulemap);
+                    pushstring("-fmodules-cache-path=" + modulecache);
+
+                    /* the preprocessed source imports modules only this host has */
+                    cmdargs.settings.distributeclang.clear();
+                }
+            }
 
             /*
              * For libstdc++ 6, the C++ includes must appear before the standard
@@ -1745,17 +2528,66 @@ int main(int argc, char **argv)
              *
              * https://gcc.gnu.org/bugzilla/show_bug.cgi?id=70129
              */
+
             pushdirs(intrinpaths);
             pushdirs(cxxpaths);
             pushdirs(stdpaths);
         }
     }
 
+    string_vector dlltool;
+    bool haveresources = false;
+
     for (int i = 1; i < argc; ++i)
     {
         const char *arg = argv[i];
-        static constexpr size_t BUFSIZE = STRLEN(COMMANDPREFIX)+2;
-        char buf[BUFSIZE];
+        const char *def = nullptr;
+        const char *ext = std::strrchr(arg, '.');
+
+        /* compiled in runcompiler(), also for -c app.rc */
+        if (*arg != '-' && ext && !std::strcmp(ext, ".rc"))
+            haveresources = true;
+
+        /*
+         * Link against the import library of a .def file,
+         * a .def file passed with -shared or -mdll lists
+         * the exports of the DLL being built instead
+         */
+
+        if (!std::strncmp(arg, IMPORTOPT, STRLEN(IMPORTOPT)))
+            def = arg + STRLEN(IMPORTOPT);
+        else if (*arg != '-' && ext && !std::strcmp(ext, ".def") && !cmdargs.isshared &&
+                 cmdargs.usemingwlinker != subsystem::dll)
+            def = arg;
+
+        if (def && cmdargs.islinkstep)
+        {
+            std::string lib;
+            std::string err;
+            tracespan span("import library");
+
+            if (dlltool.empty())
+            {
+                std::string tool;
+
+                if (!getbinutil(cmdargs, "llvm-dlltool", "DLLTOOL", tool))
+                    return 1;
+
+                dlltool.push_back(tool);
+                dlltool.push_back("-m");
+                dlltool.push_back(targettype == TARGET_WIN64 ? "i386:x86-64" : "i386");
+            }
+
+            if (!getimportlibrary(def, dlltool, lib, err))
+            {
+                std::cerr << err << "cannot generate the import library of "
+                          << def << std::endl;
+                return 1;
+            }
+
+            cargsvector.push_back(cargsarena.copy(lib));
+            continue;
+        }
 
         if (!std::strncmp(arg, COMMANDPREFIX, STRLEN(COMMANDPREFIX)))
             continue;
@@ -1763,10 +2595,7 @@ int main(int argc, char **argv)
         if (cmdargs.exceptions == 1 && !std::strcmp(arg, "-fexceptions"))
             continue;
 
-        *buf = '-';
-        std::memcpy(buf+1, COMMANDPREFIX, BUFSIZE-1);
-
-        if (!std::strncmp(arg, buf, BUFSIZE))
+        if (*arg == '-' && !std::strncmp(arg+1, COMMANDPREFIX, STRLEN(COMMANDPREFIX)))
             continue;
 
         if (cmdargs.islinkstep && cmdargs.usemingwlinker != subsystem::standard)
@@ -1775,21 +2604,24 @@ int main(int argc, char **argv)
                 continue;
         }
 
-        args.push_back(argv[i]);
+        cargsvector.push_back(argv[i]);
     }
 
-    cargs = new char* [args.size()+2];
-    cargs[args.size()] = nullptr;
+    cargsvector.push_back(nullptr);
+    cargs = cargsvector.data();
 
-    for (const auto &opt : args)
-        cargs[cargsi++] = strdup(opt.c_str());
+    cmdargs.settings.rccompiler.clear();
 
-    if (cmdargs.appendexe)
-        appendexetooutputname(cargs);
+    if (haveresources)
+    {
+        if (!getbinutil(cmdargs, "llvm-windres", "WINDRES", cmdargs.settings.rccompiler))
+            return 1;
 
-    /*
-     * Execute command
-     */
+        cmdargs.settings.rctarget = targettype == TARGET_WIN64 ? "pe-x86-64" : "pe-i386";
+    }
+
+    if (cmdargs.appendexe)
+        appendexetooutputname(cargs, cargsarena);
 
     if (cmdargs.verbose)
     {
@@ -1813,9 +2645,384 @@ int main(int argc, char **argv)
         printtimes();
     }
 
-    execvp(compiler.c_str(), cargs);
+    compilerout.swap(compiler);
+    cargsout = cargs;
+    settings = cmdargs.settings;
+    return 0;
+}
+
+#ifndef WCLANG_NO_MAIN /* the benchmarks include this file */
+
+/*
+ * Runs the final compiler command,
+ * also used for the jobs of -wc-jobs
+ */
+
+static int runcompiler(const std::string &compiler, char **cargs)
+{
+    int ret;
+
+    /*
+     * Compile the resource scripts among the inputs (.rc)
+     */
+
+    if (!settings.rccompiler.empty())
+    {
+        tracespan span("resources");
+
+        if ((ret = compileresources(settings.rccompiler.c_str(),
+                                    settings.rctarget.c_str(), cargs)) !=
+            RESOURCES_NOT_APPLICABLE)
+        {
+            return ret;
+        }
+    }
+
+    /*
+     * Use a precompiled header for the system headers (-wc-auto-pch)
+     */
+
+    if (settings.autopch)
+    {
+        tracespan span("auto-pch");
+        useautopch(compiler, cargs, settings.autopchheaders);
+    }
+
+    /*
+     * Link with the job slots make has left (-wc-linker=lld, -wc-thinlto)
+     */
+
+    if (settings.linkthreads < 1)
+    {
+        std::vector<char**> threadargs;
+        string_vector newargs;
+        int slots;
+
+        for (char **arg = cargs; *arg; ++arg)
+        {
+            for (const char *opt : LINKTHREADSOPTS)
+                if (!std::strncmp(*arg, opt, std::strlen(opt))) threadargs.push_back(arg);
+        }
+
+        if (!threadargs.empty() &&
+            (slots = acquirejobslots(sysconf(_SC_NPROCESSORS_ONLN) - 1)) != -1)
+        {
+            std::string threads = std::to_string(1 + slots);
+
+            newargs.reserve(threadargs.size());
+
+            for (char **arg : threadargs)
+            {
+                newargs.push_back(std::string(*arg, std::strchr(*arg, '=') + 1) + threads);
+                *arg = &newargs.back()[0];
+            }
+
+            tracespan span("link", threads + " threads");
+            ret = runprocess(cargs);
+            releasejobslots();
+
+            if (ret != RUNCOMMAND_ERROR)
+                return ret;
+
+            std::cerr << "invoking compiler failed" << std::endl;
+            return 1;
+        }
+    }
+
+    /*
+     * Compile through the object cache (-wc-cache)
+     */
+
+    if (settings.objectcache)
+    {
+        tracespan span("object cache");
+
+        if ((ret = runcachedcompile(compiler, cargs, settings)) != OBJECTCACHE_UNCACHEABLE)
+            return ret;
+    }
+
+    /*
+     * Compile on a worker (-wc-distribute)
+     */
+
+    if (settings.distribute)
+    {
+        tracespan span("distributed compile");
+        std::string err;
+
+        ret = rundistributedcompile(compiler, cargs, settings, err);
+        std::cerr << err;
+
+        if (ret != DISTRIBUTE_LOCAL)
+            return ret;
+    }
+
+    /*
+     * Execute command, wait for it when tracing
+     */
+
+    if (istraceenabled())
+    {
+        tracespan span("compiler", compiler);
+
+        if ((ret = runprocess(cargs)) != RUNCOMMAND_ERROR)
+            return ret;
+    }
+    else
+    {
+        execvp(compiler.c_str(), useresponsefile(cargs));
+    }
 
     std::cerr << "invoking compiler failed" << std::endl;
     std::cerr << compiler << " not installed?" << std::endl;
     return 1;
 }
+
+/*
+ * Runs the command built by buildcommand(),
+ * split into parallel jobs with -wc-jobs
+ */
+
+static int runbuild(const std::string &compiler, char **cargs)
+{
+    int ret = JOBS_NOT_APPLICABLE;
+
+    /*
+     * Record the command line(s) for compile_commands.json (-wc-compdb)
+     */
+
+    if (!settings.compdb.empty())
+    {
+        tracespan compdbspan("compdb");
+        recordcompilecommand(settings.compdb.c_str(), compiler, cargs);
+    }
+
+    /*
+     * Compile multiple source files in parallel (-wc-jobs=N)
+     */
+
+    if (settings.jobs > 1)
+    {
+        tracespan jobsspan("parallel build");
+
+        ret = runparallelbuild(compiler, cargs, settings.jobs, settings.failfast,
+                               runcompiler);
+    }
+
+    if (ret == JOBS_NOT_APPLICABLE)
+        ret = runcompiler(compiler, cargs);
+
+    return ret;
+}
+
+/*
+ * Runs the build of one target of -wc-targets,
+ * in a child process
+ */
+
+static int runtargetjob(const std::string &, char **argv)
+{
+    std::string compiler;
+    char **cargs;
+    int argc = 0;
+    int ret;
+
+    while (argv[argc]) ++argc;
+
+    if ((ret = buildcommand(argc, argv, compiler, cargs)))
+        return ret;
+
+    return runbuild(compiler, cargs);
+}
+
+/*
+ * Runs one job of -wc-batch, in a child
+ * process of the batch
+ */
+
+static int runbatchjob(const std::string &, char **argv)
+{
+    std::string compiler;
+    char **cargs;
+    int argc = 0;
+    int ret;
+
+    while (argv[argc]) ++argc;
+
+    if ((ret = buildcommand(argc, argv, compiler, cargs)))
+        return ret;
+
+    if (!settings.compdb.empty())
+        recordcompilecommand(settings.compdb.c_str(), compiler, cargs);
+
+    return runcompiler(compiler, cargs);
+}
+
+/*
+ * clang writes the -ftime-trace output next to the object file
+ */
+
+static void readclangtrace(char **cargs, std::string &trace)
+{
+    for (char **arg = cargs; *arg; ++arg)
+    {
+        if (std::strcmp(*arg, "-o") || !arg[1])
+            continue;
+
+        std::string file = arg[1];
+        size_t pos = file.find_last_of('.');
+
+        if (pos != std::string::npos && file.find(PATHDIV, pos) == std::string::npos)
+            file.resize(pos);
+
+        file += ".json";
+
+        if (readfile(file.c_str(), trace))
+            unlink(file.c_str());
+
+        return;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string compiler;
+    char **cargs = nullptr;
+    const char *batchfile = nullptr;
+    const char *targets = nullptr;
+    const char *p;
+    int ret;
+
+    if (!std::strcmp(getfileName(argv[0]), "wclangd"))
+        return rundaemon(argc, argv, buildcommand, settings);
+
+    if (!std::strcmp(getfileName(argv[0]), "wclang-worker"))
+        return runworker(argc, argv);
+
+    /*
+     * @file arguments, must be expanded before -wc-* is looked at
+     */
+
+    expandresponsefiles(argc, argv);
+
+    /*
+     * -wc-trace=<file> must be known before anything else happens,
+     * -wc-compdb-compact[=<file>] needs no toolchain,
+     * -wc-batch=<file> and -wc-targets=<targets> change
+     * what the invocation does
+     */
+
+    if ((p = getenv("WCLANG_TRACE")) && *p)
+        enabletrace(p);
+
+    bool failfast = (p = getenv("WCLANG_FAIL_FAST")) && *p == '1';
+    const char *compdb = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        const char *value;
+        const optioninfo *opt;
+
+        if (!std::strncmp(arg, "--", STRLEN("--"))) ++arg;
+
+        if (!(opt = findoption(arg, &value)))
+            continue;
+
+        switch (opt->id)
+        {
+            case optionid::wc_trace:
+                enabletrace(value);
+                break;
+            case optionid::wc_compdb_compact:
+                if (!compdb) compdb = value;
+                break;
+            case optionid::wc_batch:
+                batchfile = value;
+                break;
+            case optionid::wc_targets:
+                targets = value;
+                break;
+            case optionid::wc_fail_fast:
+                failfast = true; /* for -wc-targets */
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (compdb)
+    {
+        if (!*compdb && !(compdb = getenv("WCLANG_COMPDB")))
+            compdb = "compile_commands.json";
+
+        return compactcompdb(compdb);
+    }
+
+    tracespan span("wclang");
+
+    if (batchfile)
+    {
+        /*
+         * Resolve the toolchain (and apply the -wc-* options
+         * of the batch invocation) once, for all jobs
+         */
+
+        pintoolchain = true;
+
+        if ((ret = buildcommand(argc, argv, compiler, cargs)))
+            return ret;
+
+        long jobs = settings.jobs;
+        tracespan batchspan("batch");
+
+        if (jobs < 1)
+            jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+        batchjob = true;
+        ret = runbatch(batchfile, argv[0], jobs, settings.failfast, runbatchjob);
+    }
+    else if (targets)
+    {
+        /*
+         * One build per target, every child resolves
+         * the toolchain of its target
+         */
+
+        tracespan targetsspan("targets");
+
+        ret = runmultitarget(argc, argv, targets, failfast, runtargetjob);
+    }
+    else
+    {
+        /*
+         * Let the daemon build the command if one is running,
+         * not when tracing, the phases would happen in the daemon
+         */
+
+        if ((istraceenabled() || !rundaemonclient(argc, argv, compiler, cargs, settings)) &&
+            (ret = buildcommand(argc, argv, compiler, cargs)))
+        {
+            return ret;
+        }
+
+        ret = runbuild(compiler, cargs);
+    }
+
+    if (istraceenabled())
+    {
+        std::string clangtrace;
+
+        if (clangtimetrace)
+            readclangtrace(cargs, clangtrace);
+
+        span.end();
+
+        if (!writetrace(clangtrace))
+            warn("cannot write trace file");
+    }
+
+    return ret;
+}
+
+#endif /* WCLANG_NO_MAIN */
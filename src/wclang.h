@@ -4,6 +4,7 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <memory>
 #include "config.h"
 
 static inline void ERRORMSG(const char *msg, const char *file,
@@ -48,22 +49,57 @@ typedef std::vector<std::string> string_vector;
 
 void concatenvvariable(const char *var, const std::string val, std::string *nval = nullptr);
 
-typedef bool (*listfilescallback)(const char *dir, const char *file);
+/*
+ * listfiles() hands its callback the open directory and the
+ * entry type readdir() reported (0: unknown), entries can be
+ * looked up relative to the directory without resolving its
+ * path again
+ */
+
+typedef bool (*listfilescallback)(int dirfd, const char *file, unsigned char type);
 bool fileexists(const char *file);
-bool isdirectory(const char *file, const char *prefix);
+bool fileexistsat(int dirfd, const char *file);
+bool maybedirectory(unsigned char type);
 bool listfiles(const char *dir, std::vector<std::string> *files, listfilescallback cmp = nullptr);
+void recordlisteddirs(std::vector<std::string> *dirs);
 const char *getfileName(const char *file);
 
 typedef bool (*realpathcmp)(const char *file, const struct stat &st);
 bool ignoreccache(const char *f, const struct stat &);
 bool wcrealpath(const char *file, std::string &result, realpathcmp cmp1 = nullptr,
                 realpathcmp cmp2 = nullptr, const size_t maxSymobolicLinkDepth = 1000);
-bool getpathofcommand(const char *bin, std::string &result);
+bool getpathofcommand(const char *bin, std::string &result, std::string *file = nullptr);
 
 constexpr int RUNCOMMAND_ERROR = -100000;
 int runcommand(const char *command, char *buf, size_t len);
+int runprocess(char *const *args, std::string *out = nullptr, std::string *err = nullptr);
 
 void stripfilename(char *path);
+std::string jsonescape(const std::string &str);
+
+/*
+ * Bump allocator for strings which are needed until
+ * the process execs or exits (or until reset())
+ */
+
+class stringarena {
+public:
+    stringarena() : current(0), used(0) {}
+
+    char *alloc(size_t len);
+    char *copy(const char *str, size_t len);
+    char *copy(const std::string &str) { return copy(str.c_str(), str.size()); }
+    char *concat(const char *str1, const char *str2);
+    void reset();
+
+private:
+    static constexpr size_t BLOCKSIZE = 16384;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<std::unique_ptr<char[]>> large;
+    size_t current;
+    size_t used;
+};
 
 struct compilerversion;
 typedef compilerversion compilerver;
@@ -173,6 +209,35 @@ enum class subsystem {
     console
 };
 
+/*
+ * What the -wc-* options (or their WCLANG_* variables) ask
+ * for beyond the compiler arguments. Kept here instead of in
+ * the environment, which the compiler and linker inherit.
+ */
+
+struct buildsettings {
+    bool autopch;
+    bool objectcache;
+    bool distribute;
+    bool failfast;
+    bool caseinsensitive;
+    bool headermap;
+    bool modules;
+    long jobs;
+    long linkthreads;
+    std::string autopchheaders;
+    std::string compdb;
+    std::string workers;
+    std::string distributeclang;
+    std::string rccompiler;
+    std::string rctarget;
+    std::string modulesheaders;
+
+    buildsettings() : autopch(false), objectcache(false), distribute(false),
+                      failfast(false), caseinsensitive(false), headermap(false),
+                      modules(false), jobs(0), linkthreads(0) {}
+};
+
 struct commandargs {
     bool verbose;
     compilerver clangversion;
@@ -187,13 +252,23 @@ struct commandargs {
     std::string &compiler;
     std::string &compilerpath;
     std::string &compilerbinpath;
+    std::string mingwbinpath;
+    std::string libgccdir;
+    string_vector listeddirs;
     string_vector &env;
-    string_vector &args;
     bool &iscxx;
     bool appendexe;
     bool iscompilestep;
     bool islinkstep;
+    bool isshared;
     bool nointrinsics;
+    bool havecxxheaders;
+    bool haveintrinsics;
+    bool havelld;
+    bool uselld;
+    bool thinlto;
+    bool invalidmingwpath;
+    buildsettings settings;
     int exceptions;
     int optimizationlevel;
     subsystem usemingwlinker;
@@ -202,12 +277,14 @@ struct commandargs {
                 string_vector &cflags, string_vector &cxxflags,
                 string_vector &linkerflags, std::string &target, std::string &compiler,
                 std::string &compilerpath, std::string &compilerbinpath, string_vector &env,
-                string_vector &args, bool &iscxx)
+                bool &iscxx)
                 :
                 verbose(false), intrinpaths(intrinpaths), stdpaths(stdpaths),
                 cxxpaths(cxxpaths), cflags(cflags), cxxflags(cxxflags),
                 linkerflags(linkerflags), target(target), compiler(compiler), compilerpath(compilerpath),
-                compilerbinpath(compilerbinpath), env(env), args(args), iscxx(iscxx),
-                appendexe(false), iscompilestep(false), islinkstep(false), nointrinsics(false),
+                compilerbinpath(compilerbinpath), env(env), iscxx(iscxx),
+                appendexe(false), iscompilestep(false), islinkstep(false), isshared(false),
+                nointrinsics(false), havecxxheaders(false), haveintrinsics(false),
+                havelld(false), uselld(false), thinlto(false), invalidmingwpath(false),
                 exceptions(-1), optimizationlevel(0), usemingwlinker(subsystem::standard) {}
 } __attribute__ ((aligned (8)));
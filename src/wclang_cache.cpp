@@ -0,0 +1,2667 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <tuple>
+#include <map>
+#include <set>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include <unistd.h>
+#include "wclang.h"
+#include "wclang_time.h"
+#include "wclang_cache.h"
+#include "wclang_options.h"
+#include "wclang_distribute.h"
+
+static constexpr char TOOLCHAINCACHEVERSION[] = "3";
+static constexpr char OBJECTCACHEVERSION[] = "1";
+static constexpr char MANIFESTVERSION[] = "1";
+static constexpr size_t MAXMANIFESTRECORDS = 16;
+static constexpr ullong OBJECTCACHESIZE = 5ULL * 1024 * 1024 * 1024;
+
+/*
+ * Tools
+ */
+
+ullong hashbytes(const void *data, size_t len, ullong h)
+{
+    /* FNV-1a */
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+
+    while (len--)
+    {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+ullong hashstring(const std::string &str, ullong h)
+{
+    return hashbytes(str.c_str(), str.size(), h);
+}
+
+void hash128::update(const void *data, size_t len)
+{
+    /*
+     * FNV-1a 128, prime = 2^88 + 0x13b
+     * (hi:lo) *= prime is computed with 64 bit arithmetic
+     */
+
+    static constexpr ullong PRIMELOW = 0x13b;
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+
+    while (len--)
+    {
+        lo ^= *p++;
+
+        ullong a = (lo & 0xffffffffULL) * PRIMELOW;
+        ullong b = (lo >> 32) * PRIMELOW;
+        ullong carry = ((a >> 32) + b) >> 32;
+
+        hi = hi * PRIMELOW + carry + (lo << 24);
+        lo = a + (b << 32);
+    }
+}
+
+std::string hashtostring(ullong h)
+{
+    static constexpr char HEX[] = "0123456789abcdef";
+    std::string s(16, '0');
+
+    for (int i = 15; i >= 0; --i, h >>= 4)
+        s[i] = HEX[h & 0xf];
+
+    return s;
+}
+
+bool getcachedir(std::string &dir, const char *subdir)
+{
+    const char *p;
+
+    if ((p = getenv("WCLANG_CACHE_DIR")) && *p)
+    {
+        dir = p;
+    }
+    else if ((p = getenv("XDG_CACHE_HOME")) && *p)
+    {
+        dir = p;
+        dir += "/wclang";
+    }
+    else if ((p = getenv("HOME")) && *p)
+    {
+        dir = p;
+        dir += "/.cache/wclang";
+    }
+    else
+    {
+        return false;
+    }
+
+    if (subdir)
+    {
+        dir += "/";
+        dir += subdir;
+    }
+
+    return true;
+}
+
+bool mkdirs(const std::string &dir)
+{
+    std::string path;
+    size_t pos = 0;
+
+    do
+    {
+        pos = dir.find(PATHDIV, pos+1);
+        path.assign(dir, 0, pos);
+
+        if (mkdir(path.c_str(), 0755) && errno != EEXIST)
+            return false;
+    } while (pos != std::string::npos);
+
+    return true;
+}
+
+bool readfile(const char *file, std::string &content)
+{
+    std::ifstream f(file, std::ios::binary);
+
+    if (!f)
+        return false;
+
+    content.assign(std::istreambuf_iterator<char>(f),
+                   std::istreambuf_iterator<char>());
+
+    return !f.bad();
+}
+
+bool writefileatomic(const std::string &file, const std::string &content)
+{
+    /*
+     * Write to a temporary file first and rename() it afterwards,
+     * so concurrent readers never see a partially written file
+     */
+
+    std::stringstream tmp;
+    tmp << file << ".tmp." << getpid();
+
+    {
+        std::ofstream f(tmp.str().c_str(), std::ios::binary | std::ios::trunc);
+
+        if (!f)
+            return false;
+
+        f.write(content.c_str(), content.size());
+
+        if (!f.flush())
+        {
+            f.close();
+            unlink(tmp.str().c_str());
+            return false;
+        }
+    }
+
+    if (rename(tmp.str().c_str(), file.c_str()))
+    {
+        unlink(tmp.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool filelock::lock(const std::string &file, bool exclusive)
+{
+    unlock();
+
+    fd = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd == -1)
+        return false;
+
+    while (flock(fd, exclusive ? LOCK_EX : LOCK_SH))
+    {
+        if (errno == EINTR)
+            continue;
+
+        unlock();
+        return false;
+    }
+
+    return true;
+}
+
+void filelock::unlock()
+{
+    if (fd == -1)
+        return;
+
+    close(fd); /* releases the lock */
+    fd = -1;
+}
+
+static void getmtime(const struct stat &st, ullong &sec, ullong &nsec)
+{
+#ifdef __APPLE__
+    sec = st.st_mtimespec.tv_sec;
+    nsec = st.st_mtimespec.tv_nsec;
+#else
+    sec = st.st_mtim.tv_sec;
+    nsec = st.st_mtim.tv_nsec;
+#endif
+}
+
+std::string fileidentity(const char *file)
+{
+    struct stat st;
+    ullong sec, nsec;
+    std::stringstream id;
+
+    ++statcalls;
+
+    if (stat(file, &st))
+        return "missing";
+
+    getmtime(st, sec, nsec);
+
+    id << (ullong)st.st_dev << ":" << (ullong)st.st_ino << ":"
+       << (ullong)st.st_size << ":" << sec << "." << nsec;
+
+    return id.str();
+}
+
+bool runcommandcached(const std::string &command, const std::string &binary,
+                      std::string &output)
+{
+    std::string dir;
+    std::string key;
+    std::string file;
+    char buf[4096];
+
+    key = command;
+    key += "\n";
+    key += fileidentity(binary.c_str());
+    key += "\n";
+
+    if (getcachedir(dir, "commands"))
+    {
+        file = dir + "/" + hashtostring(hashstring(key));
+
+        if (readfile(file.c_str(), output) &&
+            !output.compare(0, key.size(), key))
+        {
+            output.erase(0, key.size());
+            return true;
+        }
+    }
+
+    if (runcommand(command.c_str(), buf, sizeof(buf)) != 0)
+        return false;
+
+    output = buf;
+
+    while (!output.empty() && (output[output.size()-1] == '\n' ||
+                               output[output.size()-1] == '\r'))
+        output.resize(output.size()-1);
+
+    if (!file.empty() && mkdirs(dir))
+        writefileatomic(file, key + output);
+
+    return true;
+}
+
+/*
+ * Toolchain Cache
+ */
+
+static void writestamp(std::ostream &out, const std::string &dir)
+{
+    struct stat st;
+    ullong sec = 0, nsec = 0;
+
+    ++statcalls;
+
+    if (stat(dir.c_str(), &st))
+    {
+        /* must still be missing */
+        out << "stamp 0 0 0 0 " << dir << "\n";
+        return;
+    }
+
+    getmtime(st, sec, nsec);
+
+    out << "stamp " << (ullong)st.st_dev << " " << (ullong)st.st_ino << " "
+        << sec << " " << nsec << " " << dir << "\n";
+}
+
+static bool checkstamp(std::istream &in)
+{
+    struct stat st;
+    ullong dev, ino, sec, nsec;
+    ullong cursec, curnsec;
+    std::string dir;
+
+    if (!(in >> dev >> ino >> sec >> nsec) || in.get() != ' ' ||
+        !std::getline(in, dir))
+    {
+        return false;
+    }
+
+    ++statcalls;
+
+    if (stat(dir.c_str(), &st))
+        return !dev && !ino;
+
+    getmtime(st, cursec, curnsec);
+
+    return dev == (ullong)st.st_dev && ino == (ullong)st.st_ino &&
+           sec == cursec && nsec == curnsec;
+}
+
+static void splitpath(const char *p, string_vector &dirs)
+{
+    std::string dir;
+
+    if (!p)
+        return;
+
+    do
+    {
+        if (*p == ':') ++p;
+        while (*p && *p != ':') dir += *p++;
+        if (!dir.empty()) dirs.push_back(dir);
+        dir.clear();
+    } while (*p);
+}
+
+/*
+ * In-memory copies of the cache files, filled by wclangd
+ * (file -> identity, content)
+ */
+
+static std::map<std::string, std::pair<std::string, std::string>> memcache;
+
+/*
+ * Copies validated once by this process (-wc-batch),
+ * forked children use them without checking the stamps
+ */
+
+static std::set<std::string> pinned;
+
+/*
+ * When wclangd validated its pinned copies
+ */
+
+static std::map<std::string, time_t> validated;
+
+toolchaincache::toolchaincache(const char *invocationname) : enabled(false)
+{
+    std::string dir;
+    const char *p;
+
+    if ((p = getenv("WCLANG_NO_TOOLCHAIN_CACHE")) && *p != '0')
+        return;
+
+    if (!getcachedir(dir, "toolchain"))
+        return;
+
+    p = getenv("PATH");
+    key  = "wclang-toolchain-cache ";
+    key += TOOLCHAINCACHEVERSION;
+    key += " " PACKAGE_VERSION "\n";
+    key += "name ";
+    key += invocationname;
+    key += "\nPATH ";
+    key += p ? p : "";
+    key += "\nMINGW_PATH ";
+    p = getenv("MINGW_PATH");
+    key += p ? p : "";
+    key += "\n";
+
+    file = dir + "/" + hashtostring(hashstring(key));
+    enabled = true;
+}
+
+bool toolchaincache::load(commandargs &cmdargs, int &targettype)
+{
+    std::string content;
+    std::string line;
+    std::string tag;
+
+    std::string target;
+    int type = -1;
+    string_vector stdpaths, cxxpaths, intrinpaths;
+    compilerver mingwversion, clangversion;
+    std::string compilerbinpath, mingwbinpath, libgccdir;
+    bool havecxxheaders = false, haveintrinsics = false, havelld = false;
+    bool invalidmingwpath = false;
+    bool complete = false;
+
+    if (!enabled)
+        return false;
+
+    auto it = memcache.find(file);
+
+    if (it != memcache.end())
+        content = it->second.second;
+    else if (!readfile(file.c_str(), content))
+        return false;
+
+    if (content.compare(0, key.size(), key))
+        return false; /* hash collision */
+
+    std::istringstream in(content.substr(key.size()));
+    bool validate = !pinned.count(file);
+
+    while (in >> tag)
+    {
+        if (tag == "stamp")
+        {
+            if (validate ? !checkstamp(in) : !std::getline(in, line))
+                return false;
+
+            continue;
+        }
+
+        if (in.get() != ' ' || !std::getline(in, line))
+            return false;
+
+        if (tag == "target") target = line;
+        else if (tag == "targettype") type = std::atoi(line.c_str());
+        else if (tag == "stdpath") stdpaths.push_back(line);
+        else if (tag == "cxxpath") cxxpaths.push_back(line);
+        else if (tag == "intrinpath") intrinpaths.push_back(line);
+        else if (tag == "mingwversion") mingwversion = parsecompilerversion(line.c_str());
+        else if (tag == "clangversion") clangversion = parsecompilerversion(line.c_str());
+        else if (tag == "compilerbinpath") compilerbinpath = line;
+        else if (tag == "mingwbinpath") mingwbinpath = line;
+        else if (tag == "libgccdir") libgccdir = line;
+        else if (tag == "havecxxheaders") havecxxheaders = line == "1";
+        else if (tag == "haveintrinsics") haveintrinsics = line == "1";
+        else if (tag == "havelld") havelld = line == "1";
+        else if (tag == "invalidmingwpath") invalidmingwpath = line == "1";
+        else if (tag == "end") complete = true;
+        else return false;
+    }
+
+    if (!complete || target.empty() || stdpaths.empty() || mingwbinpath.empty())
+        return false;
+
+    cmdargs.target = target;
+    cmdargs.stdpaths.swap(stdpaths);
+    cmdargs.cxxpaths.swap(cxxpaths);
+    cmdargs.intrinpaths.swap(intrinpaths);
+    cmdargs.mingwversion = mingwversion;
+    cmdargs.clangversion = clangversion;
+    cmdargs.compilerbinpath = compilerbinpath;
+    cmdargs.mingwbinpath = mingwbinpath;
+    cmdargs.libgccdir = libgccdir;
+    cmdargs.havecxxheaders = havecxxheaders;
+    cmdargs.haveintrinsics = haveintrinsics;
+    cmdargs.havelld = havelld;
+    cmdargs.invalidmingwpath = invalidmingwpath;
+    targettype = type;
+
+    return true;
+}
+
+bool toolchaincache::preload()
+{
+    if (!enabled)
+        return false;
+
+    std::string id = fileidentity(file.c_str());
+    auto &entry = memcache[file];
+
+    if (entry.first == id)
+        return true;
+
+    entry.first = id;
+
+    if (!readfile(file.c_str(), entry.second))
+    {
+        memcache.erase(file);
+        return false;
+    }
+
+    return true;
+}
+
+bool toolchaincache::pin()
+{
+    if (!preload())
+        return false;
+
+    pinned.insert(file);
+    return true;
+}
+
+bool toolchaincache::keepvalidated(time_t interval)
+{
+    std::string line;
+    std::string tag;
+    time_t now = time(nullptr);
+    bool complete = false;
+
+    if (!enabled)
+        return false;
+
+    auto it = validated.find(file);
+
+    if (it != validated.end() && now - it->second < interval && pinned.count(file))
+        return true;
+
+    pinned.erase(file);
+    validated.erase(file);
+
+    if (!preload())
+        return false;
+
+    const std::string &content = memcache[file].second;
+
+    if (content.compare(0, key.size(), key))
+        return false;
+
+    std::istringstream in(content.substr(key.size()));
+
+    while (in >> tag)
+    {
+        if (tag == "stamp" ? !checkstamp(in) : !std::getline(in, line))
+            return false;
+
+        if (tag == "end")
+            complete = true;
+    }
+
+    if (!complete)
+        return false;
+
+    pinned.insert(file);
+    validated[file] = now;
+    return true;
+}
+
+bool toolchaincache::lock()
+{
+    if (!enabled)
+        return false;
+
+    size_t pos = file.find_last_of(PATHDIV);
+
+    if (!mkdirs(file.substr(0, pos)))
+    {
+        enabled = false;
+        return false;
+    }
+
+    /*
+     * Serializes concurrent cold cache invocations,
+     * only the first one runs the discovery
+     */
+
+    return lck.lock(file + ".lock");
+}
+
+void toolchaincache::unlock()
+{
+    lck.unlock();
+}
+
+void toolchaincache::store(const commandargs &cmdargs, int targettype)
+{
+    std::ostringstream out;
+    string_vector dirs;
+
+    if (!enabled)
+        return;
+
+    auto adddir = [&](std::string dir)
+    {
+        while (dir.size() > 1 && dir[dir.size()-1] == PATHDIV)
+            dir.resize(dir.size()-1);
+
+        if (!dir.empty() && std::find(dirs.begin(), dirs.end(), dir) == dirs.end())
+            dirs.push_back(dir);
+    };
+
+    auto adddirs = [&](const string_vector &paths)
+    {
+        for (const auto &dir : paths)
+            adddir(dir);
+    };
+
+    out << key;
+
+    out << "target " << cmdargs.target << "\n";
+    out << "targettype " << targettype << "\n";
+
+    for (const auto &dir : cmdargs.stdpaths) out << "stdpath " << dir << "\n";
+    for (const auto &dir : cmdargs.cxxpaths) out << "cxxpath " << dir << "\n";
+    for (const auto &dir : cmdargs.intrinpaths) out << "intrinpath " << dir << "\n";
+
+    out << "mingwversion " << cmdargs.mingwversion.s << "\n";
+    out << "clangversion " << cmdargs.clangversion.s << "\n";
+    out << "compilerbinpath " << cmdargs.compilerbinpath << "\n";
+    out << "mingwbinpath " << cmdargs.mingwbinpath << "\n";
+    out << "libgccdir " << cmdargs.libgccdir << "\n";
+    out << "havecxxheaders " << cmdargs.havecxxheaders << "\n";
+    out << "haveintrinsics " << cmdargs.haveintrinsics << "\n";
+    out << "havelld " << cmdargs.havelld << "\n";
+    out << "invalidmingwpath " << cmdargs.invalidmingwpath << "\n";
+
+    /*
+     * Every directory the discovery listed or resolved,
+     * plus all PATH entries (a new clang or mingw-gcc
+     * may show up there)
+     */
+
+    adddirs(cmdargs.listeddirs);
+    adddirs(cmdargs.stdpaths);
+    adddirs(cmdargs.cxxpaths);
+    adddirs(cmdargs.intrinpaths);
+    adddir(cmdargs.compilerbinpath);
+    adddir(cmdargs.mingwbinpath);
+    adddir(cmdargs.libgccdir);
+
+    string_vector pathdirs;
+    splitpath(getenv("PATH"), pathdirs);
+    splitpath(getenv("MINGW_PATH"), pathdirs);
+    adddirs(pathdirs);
+
+    for (const auto &dir : dirs)
+        writestamp(out, dir);
+
+    out << "end 1\n";
+
+    writefileatomic(file, out.str());
+}
+
+/*
+ * Object Cache
+ */
+
+struct objectcachestats {
+    ullong hits;
+    ullong directhits;
+    ullong misses;
+    ullong uncacheable;
+    ullong size;
+    ullong files;
+
+    objectcachestats() : hits(), directhits(), misses(), uncacheable(), size(), files() {}
+};
+
+struct compileinfo {
+    std::string source;
+    std::string output;
+    std::string depfile;
+    bool deps;
+    bool debug;
+    bool assembly;
+    string_vector ppargs;
+    string_vector systemdirs;
+    hash128 key;
+
+    compileinfo() : deps(false), debug(false), assembly(false) {}
+};
+
+static std::string replaceextension(const std::string &file, const char *ext)
+{
+    std::string name = getfileName(file.c_str());
+    size_t pos = name.find_last_of('.');
+
+    if (pos != std::string::npos)
+        name.resize(pos);
+
+    return name + ext;
+}
+
+static bool analyzecompile(const std::string &compiler, char **cargs, compileinfo &ci)
+{
+    bool compile = false;
+    int sources = 0;
+
+    ci.ppargs.push_back(compiler);
+
+    for (char **arg = cargs+1; *arg; ++arg)
+    {
+        const char *a = *arg;
+        const char *value;
+
+        if (*a == '@')
+            return false; /* response file */
+
+        if (*a != '-')
+        {
+            ci.source = a;
+            ++sources;
+            ci.ppargs.push_back(a);
+            continue;
+        }
+
+        const optioninfo *opt = findoption(a, &value);
+
+        if (!opt)
+        {
+            ci.ppargs.push_back(a);
+            continue;
+        }
+
+        if (opt->flags & OPT_NOCACHE)
+            return false;
+
+        if ((opt->flags & OPT_SEPARATE) && !*value)
+        {
+            if (!arg[1])
+                return false;
+
+            value = *++arg;
+        }
+
+        switch (opt->id)
+        {
+            case optionid::compile:
+                compile = true;
+                continue;
+            case optionid::deps:
+                ci.deps = true;
+                break;
+            case optionid::output:
+                ci.output = value;
+                break;
+            case optionid::depfile:
+                ci.depfile = value;
+                break;
+            case optionid::debug:
+                if (std::strcmp(value, "0")) ci.debug = true;
+                break;
+            case optionid::isystem:
+                ci.systemdirs.push_back(value);
+                break;
+            default:
+                break;
+        }
+
+        /*
+         * Output and dependency options are not
+         * passed to the preprocessor
+         */
+
+        if (opt->flags & OPT_NOKEY)
+            continue;
+
+        ci.ppargs.push_back(a);
+
+        if (value != a + std::strlen(opt->name))
+            ci.ppargs.push_back(value);
+    }
+
+    if (!compile || sources != 1)
+        return false;
+
+    if (ci.output.empty())
+        ci.output = replaceextension(ci.source, ".o");
+
+    if (ci.deps && ci.depfile.empty())
+    {
+        std::string dir;
+        size_t pos = ci.output.find_last_of(PATHDIV);
+
+        if (pos != std::string::npos)
+            dir = ci.output.substr(0, pos+1);
+
+        ci.depfile = dir + replaceextension(ci.output, ".d");
+    }
+
+    size_t pos = ci.source.find_last_of('.');
+    ci.assembly = pos != std::string::npos && !ci.source.compare(pos, 3, ".s");
+
+    ci.ppargs.push_back("-E");
+    return true;
+}
+
+static bool hashcommand(hash128 &h, const std::string &compiler, char **cargs,
+                        const compileinfo &ci)
+{
+    h.update(std::string("wclang-object-cache ") + OBJECTCACHEVERSION);
+    h.update(fileidentity(compiler.c_str()));
+
+    for (char **arg = cargs+1; *arg; ++arg)
+    {
+        const char *value;
+        const optioninfo *opt;
+
+        /*
+         * The output name only matters for the
+         * dependency file
+         */
+
+        if (**arg == '-' && (opt = findoption(*arg, &value)) &&
+            ((opt->id == optionid::output && !ci.deps) || opt->id == optionid::depfile))
+        {
+            h.update(opt->name, std::strlen(opt->name)+1);
+
+            if (!*value && arg[1])
+                ++arg;
+
+            continue;
+        }
+
+        h.update(*arg, std::strlen(*arg)+1);
+    }
+
+    if (ci.debug)
+    {
+        /* the debug info contains the working directory */
+        char cwd[PATH_MAX];
+
+        if (!getcwd(cwd, sizeof(cwd)))
+            return false;
+
+        h.update(cwd);
+    }
+
+    return true;
+}
+
+static bool hastimemacros(const std::string &content)
+{
+    return content.find("__DATE__") != std::string::npos ||
+           content.find("__TIME__") != std::string::npos ||
+           content.find("__TIMESTAMP__") != std::string::npos;
+}
+
+static bool computedirectkey(const std::string &compiler, char **cargs,
+                             const compileinfo &ci, hash128 &h)
+{
+    std::string source;
+
+    if (!hashcommand(h, compiler, cargs, ci))
+        return false;
+
+    if (!readfile(ci.source.c_str(), source) || hastimemacros(source))
+        return false;
+
+    h.update("direct");
+    h.update(source);
+    return true;
+}
+
+static bool computekey(const std::string &compiler, char **cargs, compileinfo &ci,
+                       std::string &ppout)
+{
+    hash128 &h = ci.key;
+    std::string pperr;
+
+    if (!hashcommand(h, compiler, cargs, ci))
+        return false;
+
+    if (ci.assembly)
+    {
+        if (!readfile(ci.source.c_str(), ppout))
+            return false;
+    }
+    else
+    {
+        std::vector<char*> args;
+
+        for (auto &arg : ci.ppargs)
+            args.push_back(&arg[0]);
+
+        args.push_back(nullptr);
+
+        if (runprocess(args.data(), &ppout, &pperr) != 0)
+            return false;
+    }
+
+    h.update(ppout);
+    return true;
+}
+
+/*
+ * Direct mode manifests
+ *
+ * A manifest maps the direct key (command + source file) to the
+ * results it produced, each with the headers it included. Headers
+ * inside system include directories (-isystem, which includes the
+ * directories wclang found) are validated by stat() only, all others
+ * by their content digest.
+ */
+
+static void getincludes(const std::string &ppout, string_vector &includes)
+{
+    size_t pos = 0;
+
+    while (pos < ppout.size())
+    {
+        size_t end = ppout.find('\n', pos);
+        if (end == std::string::npos) end = ppout.size();
+
+        /* # <line> "<file>" <flags> */
+
+        if (ppout[pos] == '#' && pos+2 < end && ppout[pos+1] == ' ' &&
+            std::isdigit(static_cast<unsigned char>(ppout[pos+2])))
+        {
+            size_t q = ppout.find('"', pos);
+
+            if (q != std::string::npos && q < end && ppout[q+1] != '<')
+            {
+                std::string file;
+
+                for (++q; q < end && ppout[q] != '"'; ++q)
+                {
+                    if (ppout[q] == '\\' && q+1 < end) ++q;
+                    file += ppout[q];
+                }
+
+                if (std::find(includes.begin(), includes.end(), file) == includes.end())
+                    includes.push_back(file);
+            }
+        }
+
+        pos = end+1;
+    }
+}
+
+static bool issystemfile(const std::string &file, const compileinfo &ci)
+{
+    for (const auto &dir : ci.systemdirs)
+    {
+        if (!file.compare(0, dir.size(), dir) &&
+            (file.size() > dir.size() && file[dir.size()] == PATHDIV))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool lookupmanifest(const std::string &manifest, std::string &resultkey)
+{
+    std::map<std::string, std::string> digests;
+    std::string content;
+    std::string line;
+    std::string tag;
+    std::string result;
+    bool valid = false;
+
+    if (!readfile(manifest.c_str(), content))
+        return false;
+
+    std::istringstream in(content);
+
+    if (!std::getline(in, line) ||
+        line != std::string("wclang-manifest ") + MANIFESTVERSION)
+    {
+        return false;
+    }
+
+    while (in >> tag)
+    {
+        if (tag == "result")
+        {
+            in >> result;
+            valid = true;
+        }
+        else if (tag == "file")
+        {
+            char kind;
+            ullong size, sec, nsec, ino;
+            ullong cursec, curnsec;
+            std::string digest;
+            std::string file;
+            struct stat st;
+
+            if (!(in >> kind >> size >> sec >> nsec >> ino >> digest) ||
+                in.get() != ' ' || !std::getline(in, file))
+            {
+                return false;
+            }
+
+            if (!valid)
+                continue;
+
+            if (stat(file.c_str(), &st) || (ullong)st.st_size != size)
+            {
+                valid = false;
+                continue;
+            }
+
+            getmtime(st, cursec, curnsec);
+
+            if (kind == 's')
+            {
+                /* system header, assumed stable */
+                valid = cursec == sec && curnsec == nsec && (ullong)st.st_ino == ino;
+                continue;
+            }
+
+            auto it = digests.find(file);
+
+            if (it == digests.end())
+            {
+                hash128 h;
+
+                if (!readfile(file.c_str(), content))
+                    return false;
+
+                h.update(content);
+                it = digests.insert(std::make_pair(file, h.str())).first;
+            }
+
+            valid = it->second == digest;
+        }
+        else if (tag == "end")
+        {
+            if (valid)
+            {
+                resultkey = result;
+                return true;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+static void addmanifestrecord(const std::string &manifest, const std::string &resultkey,
+                              const std::string &ppout, const compileinfo &ci,
+                              time_t starttime)
+{
+    std::string header = std::string("wclang-manifest ") + MANIFESTVERSION + "\n";
+    string_vector includes;
+    std::ostringstream record;
+    std::string content;
+    std::string old;
+
+    getincludes(ppout, includes);
+    record << "result " << resultkey << "\n";
+
+    for (const auto &file : includes)
+    {
+        struct stat st;
+        ullong sec, nsec;
+
+        if (file == ci.source)
+            continue; /* part of the direct key */
+
+        if (stat(file.c_str(), &st))
+            return;
+
+        getmtime(st, sec, nsec);
+
+        /* modified while we were compiling, don't trust it */
+        if ((time_t)sec >= starttime)
+            return;
+
+        if (issystemfile(file, ci))
+        {
+            record << "file s " << (ullong)st.st_size << " " << sec << " " << nsec
+                   << " " << (ullong)st.st_ino << " - " << file << "\n";
+            continue;
+        }
+
+        hash128 h;
+
+        if (!readfile(file.c_str(), content) || hastimemacros(content))
+            return;
+
+        h.update(content);
+
+        record << "file c " << (ullong)st.st_size << " " << sec << " " << nsec
+               << " " << (ullong)st.st_ino << " " << h.str() << " " << file << "\n";
+    }
+
+    record << "end\n";
+
+    /*
+     * Newest record first, keep at most MAXMANIFESTRECORDS,
+     * concurrent updates may drop a record, that's fine
+     */
+
+    content = header + record.str();
+
+    if (!mkdirs(manifest.substr(0, manifest.rfind(PATHDIV))))
+        return;
+
+    if (readfile(manifest.c_str(), old) && !old.compare(0, header.size(), header))
+    {
+        size_t pos = header.size();
+
+        for (size_t n = 1; n < MAXMANIFESTRECORDS && pos < old.size(); ++n)
+        {
+            size_t end = old.find("end\n", pos);
+
+            if (end == std::string::npos)
+                break;
+
+            content.append(old, pos, end + STRLEN("end\n") - pos);
+            pos = end + STRLEN("end\n");
+        }
+    }
+
+    writefileatomic(manifest, content);
+}
+
+static bool copyfile(const std::string &src, const std::string &dst, bool hardlink = false)
+{
+    /*
+     * Materialize dst atomically: reflink, hardlink
+     * (if requested) or plain copy
+     */
+
+    std::stringstream tmp;
+    char buf[65536];
+    ssize_t n;
+    int in, out;
+    bool ok = true;
+
+    tmp << dst << ".tmp." << getpid();
+
+    if (hardlink)
+    {
+        unlink(tmp.str().c_str());
+
+        if (!link(src.c_str(), tmp.str().c_str()))
+        {
+            if (!rename(tmp.str().c_str(), dst.c_str()))
+                return true;
+
+            unlink(tmp.str().c_str());
+        }
+    }
+
+    if ((in = open(src.c_str(), O_RDONLY | O_CLOEXEC)) == -1)
+        return false;
+
+    out = open(tmp.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (out == -1)
+    {
+        close(in);
+        return false;
+    }
+
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in))
+#endif
+    {
+        while ((n = read(in, buf, sizeof(buf))) != 0)
+        {
+            if (n == -1)
+            {
+                if (errno == EINTR) continue;
+                ok = false;
+                break;
+            }
+
+            if (write(out, buf, n) != n)
+            {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    close(in);
+
+    if (close(out) || !ok || rename(tmp.str().c_str(), dst.c_str()))
+    {
+        unlink(tmp.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static ullong getsizelimit(const char *var, ullong defaultsize)
+{
+    const char *p = getenv(var);
+    char *end;
+    ullong size;
+
+    if (!p || !*p)
+        return defaultsize;
+
+    size = std::strtoull(p, &end, 10);
+
+    switch (*end)
+    {
+        case 'G': case 'g': size *= 1024; /* fallthrough */
+        case 'M': case 'm': size *= 1024; /* fallthrough */
+        case 'K': case 'k': size *= 1024;
+    }
+
+    return size;
+}
+
+static void loadstats(const std::string &file, objectcachestats &stats)
+{
+    std::ifstream f(file.c_str());
+    std::string tag;
+    ullong val;
+
+    while (f >> tag >> val)
+    {
+        if (tag == "hits") stats.hits = val;
+        else if (tag == "directhits") stats.directhits = val;
+        else if (tag == "misses") stats.misses = val;
+        else if (tag == "uncacheable") stats.uncacheable = val;
+        else if (tag == "size") stats.size = val;
+        else if (tag == "files") stats.files = val;
+    }
+}
+
+static void savestats(const std::string &file, const objectcachestats &stats)
+{
+    std::ostringstream out;
+
+    out << "hits " << stats.hits << "\n"
+        << "directhits " << stats.directhits << "\n"
+        << "misses " << stats.misses << "\n"
+        << "uncacheable " << stats.uncacheable << "\n"
+        << "size " << stats.size << "\n"
+        << "files " << stats.files << "\n";
+
+    writefileatomic(file, out.str());
+}
+
+static ullong getentrysize(const std::string &entry)
+{
+    static constexpr const char* FILES[] = { "object", "stderr", "deps" };
+    struct stat st;
+    ullong size = 0;
+
+    for (const char *file : FILES)
+        if (!stat((entry + "/" + file).c_str(), &st)) size += st.st_size;
+
+    return size;
+}
+
+static void removeentry(const std::string &entry)
+{
+    static constexpr const char* FILES[] = { "object", "stderr", "deps" };
+
+    if (!unlink(entry.c_str()))
+        return; /* manifest */
+
+    for (const char *file : FILES)
+        unlink((entry + "/" + file).c_str());
+
+    rmdir(entry.c_str());
+}
+
+static void cleanupcache(const std::string &dir, objectcachestats &stats, ullong limit)
+{
+    /*
+     * Evict the least recently used entries (the entry
+     * directory mtime is bumped on every hit) until the
+     * cache is below 80% of its size limit
+     */
+
+    typedef std::tuple<ullong, ullong, std::string> entry_tuple;
+    std::vector<entry_tuple> entries;
+    string_vector subdirs, names;
+    ullong total = 0;
+
+    listfiles(dir.c_str(), &subdirs);
+
+    for (const auto &subdir : subdirs)
+    {
+        std::string path = dir + "/" + subdir;
+
+        if (subdir.size() != 2 || !listfiles(path.c_str(), &names))
+            continue;
+
+        for (const auto &name : names)
+        {
+            std::string entry = path + "/" + name;
+            struct stat st;
+            ullong sec, nsec;
+
+            if (name.find(".tmp.") != std::string::npos || stat(entry.c_str(), &st))
+                continue;
+
+            getmtime(st, sec, nsec);
+
+            ullong size = S_ISDIR(st.st_mode) ? getentrysize(entry) : st.st_size;
+            entries.push_back(entry_tuple(sec, size, entry));
+            total += size;
+        }
+    }
+
+    std::sort(entries.begin(), entries.end());
+
+    size_t i = 0;
+
+    for (; i < entries.size() && total > limit / 10 * 8; ++i)
+    {
+        removeentry(std::get<2>(entries[i]));
+        total -= std::get<1>(entries[i]);
+    }
+
+    stats.size = total;
+    stats.files = entries.size() - i;
+}
+
+static void updatestats(const std::string &dir, const objectcachestats &delta)
+{
+    std::string file = dir + "/stats";
+    objectcachestats stats;
+    filelock lck;
+    ullong limit;
+
+    if (!mkdirs(dir) || !lck.lock(dir + "/stats.lock"))
+        return;
+
+    loadstats(file, stats);
+
+    stats.hits += delta.hits;
+    stats.directhits += delta.directhits;
+    stats.misses += delta.misses;
+    stats.uncacheable += delta.uncacheable;
+    stats.size += delta.size;
+    stats.files += delta.files;
+
+    limit = getsizelimit("WCLANG_CACHE_SIZE", OBJECTCACHESIZE);
+
+    if (limit && stats.size > limit)
+        cleanupcache(dir, stats, limit);
+
+    savestats(file, stats);
+}
+
+static bool writeall(int fd, const std::string &data)
+{
+    const char *p = data.c_str();
+    size_t len = data.size();
+
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static std::string getentrypath(const std::string &dir, const std::string &hash)
+{
+    return dir + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+static bool restoreentry(const std::string &entry, const compileinfo &ci, bool hardlink)
+{
+    std::string err;
+
+    if (!copyfile(entry + "/object", ci.output, hardlink) ||
+        (ci.deps && !copyfile(entry + "/deps", ci.depfile)))
+    {
+        return false;
+    }
+
+    if (readfile((entry + "/stderr").c_str(), err))
+        writeall(STDERR_FILENO, err);
+
+    utimes(entry.c_str(), nullptr); /* LRU */
+    return true;
+}
+
+int runcachedcompile(const std::string &compiler, char **cargs,
+                     const buildsettings &settings)
+{
+    compileinfo ci;
+    objectcachestats delta;
+    std::string dir;
+    std::string entry;
+    std::string manifest;
+    std::string resultkey;
+    std::string ppout;
+    std::string err;
+    hash128 directkey;
+    const char *p;
+    bool hardlink;
+    bool direct;
+    time_t starttime = time(nullptr);
+    int ret;
+
+    if (!getcachedir(dir, "objects"))
+        return OBJECTCACHE_UNCACHEABLE;
+
+    if (!analyzecompile(compiler, cargs, ci))
+    {
+        delta.uncacheable = 1;
+        updatestats(dir, delta);
+        return OBJECTCACHE_UNCACHEABLE;
+    }
+
+    hardlink = (p = getenv("WCLANG_CACHE_HARDLINK")) && *p == '1';
+    direct = (!(p = getenv("WCLANG_CACHE_DIRECT")) || *p != '0') && !ci.assembly;
+
+    /*
+     * Direct mode: no need to run the preprocessor
+     * if the headers did not change
+     */
+
+    if (direct && (direct = computedirectkey(compiler, cargs, ci, directkey)))
+    {
+        manifest = getentrypath(dir, directkey.str()) + ".manifest";
+
+        if (lookupmanifest(manifest, resultkey) &&
+            restoreentry(getentrypath(dir, resultkey), ci, hardlink))
+        {
+            utimes(manifest.c_str(), nullptr);
+            delta.hits = delta.directhits = 1;
+            updatestats(dir, delta);
+            return 0;
+        }
+    }
+
+    /*
+     * Preprocessor mode
+     */
+
+    if (!computekey(compiler, cargs, ci, ppout))
+    {
+        delta.uncacheable = 1;
+        updatestats(dir, delta);
+        return OBJECTCACHE_UNCACHEABLE;
+    }
+
+    resultkey = ci.key.str();
+    entry = getentrypath(dir, resultkey);
+
+    if (restoreentry(entry, ci, hardlink))
+    {
+        if (direct) addmanifestrecord(manifest, resultkey, ppout, ci, starttime);
+
+        delta.hits = 1;
+        updatestats(dir, delta);
+        return 0;
+    }
+
+    /*
+     * Miss
+     */
+
+    if (!settings.distribute ||
+        (ret = rundistributedcompile(compiler, cargs, settings, err)) == DISTRIBUTE_LOCAL)
+    {
+        ret = runprocess(cargs, nullptr, &err);
+    }
+
+    writeall(STDERR_FILENO, err);
+
+    if (ret != 0)
+        return ret == RUNCOMMAND_ERROR ? EXIT_FAILURE : ret;
+
+    std::stringstream tmp;
+    tmp << entry << ".tmp." << getpid();
+
+    delta.misses = 1;
+
+    if (mkdirs(tmp.str()) &&
+        copyfile(ci.output, tmp.str() + "/object") &&
+        (!ci.deps || copyfile(ci.depfile, tmp.str() + "/deps")) &&
+        writefileatomic(tmp.str() + "/stderr", err) &&
+        !rename(tmp.str().c_str(), entry.c_str()))
+    {
+        delta.size = getentrysize(entry);
+        delta.files = 1;
+    }
+    else
+    {
+        /* someone else published it in the meantime */
+        removeentry(tmp.str());
+    }
+
+    if (direct)
+        addmanifestrecord(manifest, resultkey, ppout, ci, starttime);
+
+    updatestats(dir, delta);
+    return 0;
+}
+
+void printobjectcachestats()
+{
+    std::string dir;
+    objectcachestats stats;
+    ullong limit = getsizelimit("WCLANG_CACHE_SIZE", OBJECTCACHESIZE);
+
+    if (!getcachedir(dir, "objects"))
+    {
+        std::cerr << "cannot determine cache directory" << std::endl;
+        return;
+    }
+
+    loadstats(dir + "/stats", stats);
+
+    ullong calls = stats.hits + stats.misses;
+    float hitrate = calls ? stats.hits * 100.0f / calls : 0.0f;
+
+    std::cout << "cache directory:   " << dir << std::endl;
+    std::cout << "cache hits:        " << stats.hits << std::endl;
+    std::cout << " (direct):         " << stats.directhits << std::endl;
+    std::cout << "cache misses:      " << stats.misses << std::endl;
+    std::cout << "hit rate:          " << hitrate << " %" << std::endl;
+    std::cout << "uncacheable calls: " << stats.uncacheable << std::endl;
+    std::cout << "cached objects:    " << stats.files << std::endl;
+    std::cout << "cache size:        " << stats.size / (1024.0f*1024.0f) << " MB"
+              << " (limit: " << limit / (1024.0f*1024.0f) << " MB)" << std::endl;
+}
+
+/*
+ * ThinLTO cache (-wc-thinlto)
+ *
+ * lld keeps the backend objects in a directory per target.
+ * Before a link, at most every CACHEPRUNEINTERVAL, files
+ * unused for WCLANG_THINLTO_CACHE_AGE days are removed, then
+ * the least recently used ones until the directory is below
+ * WCLANG_THINLTO_CACHE_SIZE.
+ */
+
+static constexpr time_t CACHEPRUNEINTERVAL = 20*60;
+static constexpr ullong THINLTOCACHESIZE = 2ULL * 1024 * 1024 * 1024;
+static constexpr long THINLTOCACHEAGE = 7; /* days */
+
+bool getthinltocachedir(const std::string &target, std::string &dir)
+{
+    if (!getcachedir(dir, "thinlto"))
+        return false;
+
+    dir += "/" + target;
+    return mkdirs(dir);
+}
+
+typedef std::pair<time_t, std::string> file_pair;
+
+/* the clang module cache keeps its files one directory down */
+static void collectcachefiles(const std::string &dir, int depth, time_t now, long age,
+                              std::vector<file_pair> &files, ullong &total)
+{
+    string_vector names;
+    struct stat st;
+
+    listfiles(dir.c_str(), &names);
+
+    for (const auto &name : names)
+    {
+        std::string file = dir + "/" + name;
+
+        if (name[0] == '.' || stat(file.c_str(), &st))
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            if (depth < 1)
+                collectcachefiles(file, depth+1, now, age, files, total);
+
+            continue;
+        }
+
+        if (!S_ISREG(st.st_mode))
+            continue;
+
+        /* lld and clang bump the access time of the files they reuse */
+        time_t lastuse = std::max(st.st_atime, st.st_mtime);
+
+        if (now - lastuse > age * 24*60*60)
+        {
+            unlink(file.c_str());
+            continue;
+        }
+
+        files.push_back(file_pair(lastuse, file));
+        total += st.st_size;
+    }
+}
+
+static void prunecachedir(const std::string &dir, const char *sizevar, ullong defaultsize,
+                          const char *agevar, long defaultage)
+{
+    std::vector<file_pair> files;
+    std::string stamp = dir + "/.pruned";
+    struct stat st;
+    filelock lck;
+    time_t now = time(nullptr);
+    ullong limit = getsizelimit(sizevar, defaultsize);
+    ullong total = 0;
+    const char *p;
+    long age;
+
+    if (!stat(stamp.c_str(), &st) && now - st.st_mtime < CACHEPRUNEINTERVAL)
+        return;
+
+    if (!lck.lock(dir + "/.lock") || !writefileatomic(stamp, std::string()))
+        return;
+
+    if (!(p = getenv(agevar)) || (age = std::atol(p)) < 1)
+        age = defaultage;
+
+    collectcachefiles(dir, 0, now, age, files, total);
+
+    if (!limit || total <= limit)
+        return;
+
+    std::sort(files.begin(), files.end());
+
+    for (size_t i = 0; i < files.size() && total > limit / 10 * 8; ++i)
+    {
+        if (!stat(files[i].second.c_str(), &st) && !unlink(files[i].second.c_str()))
+            total -= std::min<ullong>(st.st_size, total);
+    }
+}
+
+void prunethinltocache(const std::string &dir)
+{
+    prunecachedir(dir, "WCLANG_THINLTO_CACHE_SIZE", THINLTOCACHESIZE,
+                  "WCLANG_THINLTO_CACHE_AGE", THINLTOCACHEAGE);
+}
+
+/*
+ * Automatic precompiled headers (-wc-auto-pch)
+ *
+ * If a source file starts with #include directives of headers
+ * from the configured set, a PCH of exactly these headers (in
+ * that order) is built once per compiler, language and flags and
+ * passed with -include-pch. The PCH is validated by the identity
+ * of every file it was built from and rebuilt if any of them
+ * changed, so a stale or mismatching PCH is never used.
+ *
+ * A replaced PCH may still be read by running compiles, it is
+ * left to the pruning of the PCH cache like any other unused
+ * file (WCLANG_AUTO_PCH_CACHE_AGE, WCLANG_AUTO_PCH_CACHE_SIZE).
+ */
+
+static constexpr char PCHVERSION[] = "1";
+static constexpr time_t PCHRETRYINTERVAL = 10*60;
+static constexpr ullong PCHCACHESIZE = 1ULL * 1024 * 1024 * 1024;
+static constexpr long PCHCACHEAGE = 7; /* days */
+
+static constexpr const char* DEFAULTPCHHEADERS[] = {
+    "windows.h", "stdio.h", "stdlib.h", "string.h", "math.h",
+    "string", "vector", "map", "unordered_map", "set", "memory",
+    "algorithm", "functional", "iostream", "sstream", "fstream"
+};
+
+/* a comma separated list (-wc-auto-pch=, -wc-modules=), or the defaults */
+template<size_t N>
+static void getheaderlist(const std::string &list, const char* const (&defaults)[N],
+                          string_vector &headers)
+{
+    if (list.empty())
+    {
+        for (const char *header : defaults)
+            headers.push_back(header);
+
+        return;
+    }
+
+    size_t pos = 0;
+
+    while (pos <= list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+
+        if (end > pos)
+            headers.push_back(list.substr(pos, end-pos));
+
+        pos = end+1;
+    }
+}
+
+static size_t skipspaceandcomments(const std::string &src, size_t pos)
+{
+    while (pos < src.size())
+    {
+        if (std::isspace(static_cast<unsigned char>(src[pos])))
+        {
+            ++pos;
+        }
+        else if (!src.compare(pos, 2, "//"))
+        {
+            pos = src.find('\n', pos);
+            if (pos == std::string::npos) return src.size();
+        }
+        else if (!src.compare(pos, 2, "/*"))
+        {
+            pos = src.find("*/", pos+2);
+            if (pos == std::string::npos) return src.size();
+            pos += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return pos;
+}
+
+/*
+ * Collect the leading '#include <header>' lines of a source file,
+ * stop at anything else (including headers not in the set)
+ */
+
+static void getincludeprefix(const std::string &src, const string_vector &headers,
+                             string_vector &prefix)
+{
+    size_t pos = 0;
+
+    while ((pos = skipspaceandcomments(src, pos)) < src.size() && src[pos] == '#')
+    {
+        size_t end = src.find('\n', pos);
+        if (end == std::string::npos) end = src.size();
+
+        std::string line = src.substr(pos+1, end-pos-1);
+        size_t i = line.find_first_not_of(" \t");
+
+        if (i == std::string::npos || line.compare(i, STRLEN("include"), "include"))
+            break;
+
+        i = line.find_first_not_of(" \t", i+STRLEN("include"));
+
+        if (i == std::string::npos || line[i] != '<')
+            break;
+
+        size_t close = line.find('>', i);
+
+        if (close == std::string::npos)
+            break;
+
+        std::string header = line.substr(i+1, close-i-1);
+        size_t rest = line.find_first_not_of(" \t\r", close+1);
+
+        if (rest != std::string::npos && line.compare(rest, 2, "//") &&
+            line.compare(rest, 2, "/*"))
+        {
+            break;
+        }
+
+        if (std::find(headers.begin(), headers.end(), header) == headers.end())
+            break;
+
+        prefix.push_back(header);
+        pos = end;
+    }
+}
+
+/*
+ * Parse a make style dependency file written by -MF
+ */
+
+static void parsedepfile(const std::string &content, string_vector &files)
+{
+    std::string file;
+    bool target = true;
+
+    for (size_t i = 0; i <= content.size(); ++i)
+    {
+        char c = i < content.size() ? content[i] : ' ';
+
+        if (c == '\\' && i+1 < content.size())
+        {
+            char n = content[++i];
+
+            if (n == '\n') c = ' ';
+            else if (n == '\r') { c = ' '; if (content[i+1] == '\n') ++i; }
+            else { file += n; continue; }
+        }
+
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            if (file.empty())
+                continue;
+
+            if (target && file[file.size()-1] == ':')
+                target = false;
+            else if (!target)
+                files.push_back(file);
+
+            file.clear();
+            continue;
+        }
+
+        file += c;
+    }
+}
+
+/*
+ * The 'current' file of a PCH directory names the PCH
+ * file followed by the identity of all its inputs
+ */
+
+static bool checkpch(const std::string &current, std::string &pch)
+{
+    std::string content;
+    std::string line;
+
+    if (!readfile(current.c_str(), content))
+        return false;
+
+    std::istringstream in(content);
+
+    if (!std::getline(in, line) || line.compare(0, STRLEN("pch "), "pch "))
+        return false;
+
+    pch = line.substr(STRLEN("pch "));
+
+    while (std::getline(in, line))
+    {
+        size_t pos = line.find(' ');
+
+        if (pos == std::string::npos)
+            return false;
+
+        if (line.compare(0, pos, fileidentity(line.c_str()+pos+1)))
+            return false; /* an input changed */
+    }
+
+    return access(pch.c_str(), R_OK) == 0;
+}
+
+static bool buildpch(const std::string &dir, const compileinfo &ci, const char *lang,
+                     const string_vector &prefix, std::string &pch, std::string &err)
+{
+    std::string header = dir + "/prefix.h";
+    std::string tmppch;
+    std::string depfile;
+    std::string content;
+    string_vector args;
+    string_vector files;
+    hash128 stamps;
+    std::stringstream current;
+
+    for (const auto &h : prefix)
+        content += "#include <" + h + ">\n";
+
+    if (!writefileatomic(header, content))
+        return false;
+
+    std::stringstream tmp;
+    tmp << dir << "/tmp." << getpid();
+    tmppch = tmp.str() + ".pch";
+    depfile = tmp.str() + ".d";
+
+    /* the preprocessor arguments minus the source file and -E */
+
+    args.push_back(ci.ppargs[0]);
+    args.push_back("-x");
+    args.push_back(lang);
+
+    for (size_t i = 1; i+1 < ci.ppargs.size(); ++i)
+    {
+        if (ci.ppargs[i] == ci.source && ci.ppargs[i-1] != "-o")
+            continue;
+
+        args.push_back(ci.ppargs[i]);
+    }
+
+    args.push_back(header);
+    args.push_back("-o");
+    args.push_back(tmppch);
+    args.push_back("-MD");
+    args.push_back("-MF");
+    args.push_back(depfile);
+
+    std::vector<char*> cargs;
+
+    for (auto &arg : args)
+        cargs.push_back(&arg[0]);
+
+    cargs.push_back(nullptr);
+
+    bool ok = runprocess(cargs.data(), nullptr, &err) == 0 &&
+              readfile(depfile.c_str(), content);
+
+    unlink(depfile.c_str());
+
+    if (!ok)
+    {
+        unlink(tmppch.c_str());
+        return false;
+    }
+
+    parsedepfile(content, files);
+
+    for (const auto &file : files)
+    {
+        std::string id = fileidentity(file.c_str());
+
+        stamps.update(id);
+        stamps.update(file);
+        current << id << " " << file << "\n";
+    }
+
+    pch = dir + "/" + stamps.str() + ".pch";
+
+    if (rename(tmppch.c_str(), pch.c_str()))
+    {
+        unlink(tmppch.c_str());
+        return false;
+    }
+
+    return writefileatomic(dir + "/current", "pch " + pch + "\n" + current.str());
+}
+
+void useautopch(const std::string &compiler, char **&cargs, const std::string &headerlist)
+{
+    compileinfo ci;
+    string_vector headers;
+    string_vector prefix;
+    std::string source;
+    std::string dir;
+    std::string pch;
+    std::string failed;
+    std::string err;
+    const char *lang;
+    filelock lck;
+    hash128 key;
+    struct stat st;
+
+    if (!analyzecompile(compiler, cargs, ci) || ci.assembly)
+        return;
+
+    for (const auto &arg : ci.ppargs)
+    {
+        /* these change what comes before the first line */
+        if (arg == "-x" || arg == "-include" || arg == "-include-pch" ||
+            arg == "-imacros" || !arg.compare(0, 2, "-x"))
+        {
+            return;
+        }
+    }
+
+    const char *ext = std::strrchr(ci.source.c_str(), '.');
+
+    if (!ext)
+        return;
+
+    if (!std::strcmp(ext, ".c"))
+        lang = std::strstr(getfileName(compiler.c_str()), "++") ? "c++-header" : "c-header";
+    else if (!std::strcmp(ext, ".cpp") || !std::strcmp(ext, ".cc") ||
+             !std::strcmp(ext, ".cxx") || !std::strcmp(ext, ".C") ||
+             !std::strcmp(ext, ".c++"))
+        lang = "c++-header";
+    else
+        return;
+
+    getheaderlist(headerlist, DEFAULTPCHHEADERS, headers);
+
+    if (!readfile(ci.source.c_str(), source))
+        return;
+
+    getincludeprefix(source, headers, prefix);
+
+    if (prefix.empty())
+        return;
+
+    /*
+     * One PCH per compiler, language, flags and header list
+     */
+
+    key.update(std::string("wclang-auto-pch ") + PCHVERSION);
+    key.update(fileidentity(compiler.c_str()));
+    key.update(lang);
+
+    for (size_t i = 1; i+1 < ci.ppargs.size(); ++i)
+        if (ci.ppargs[i] != ci.source) key.update(ci.ppargs[i]);
+
+    key.update("headers");
+
+    for (const auto &h : prefix)
+        key.update(h);
+
+    if (!getcachedir(dir, "pch"))
+        return;
+
+    dir += "/" + key.str();
+    failed = dir + "/failed";
+
+    if (!checkpch(dir + "/current", pch))
+    {
+        if (!stat(failed.c_str(), &st) && time(nullptr) - st.st_mtime < PCHRETRYINTERVAL)
+            return;
+
+        if (!mkdirs(dir) || !lck.lock(dir + "/lock"))
+            return;
+
+        /* someone else may have built it while we were waiting */
+
+        if (!checkpch(dir + "/current", pch))
+        {
+            if (!buildpch(dir, ci, lang, prefix, pch, err))
+            {
+                std::cerr << "warning: cannot build precompiled header for "
+                          << ci.source << ", compiling without it" << std::endl
+                          << err;
+
+                writefileatomic(failed, "");
+                return;
+            }
+
+            unlink(failed.c_str());
+        }
+
+        lck.unlock();
+
+        prunecachedir(dir.substr(0, dir.rfind('/')), "WCLANG_AUTO_PCH_CACHE_SIZE",
+                      PCHCACHESIZE, "WCLANG_AUTO_PCH_CACHE_AGE", PCHCACHEAGE);
+    }
+
+    /*
+     * Insert -include-pch <pch> right after the compiler
+     */
+
+    size_t n = 0;
+    while (cargs[n]) ++n;
+
+    char **newcargs = new char* [n+3];
+
+    newcargs[0] = cargs[0];
+    newcargs[1] = strdup("-include-pch");
+    newcargs[2] = strdup(pch.c_str());
+
+    for (size_t i = 1; i <= n; ++i)
+        newcargs[i+2] = cargs[i];
+
+    cargs = newcargs;
+}
+
+/*
+ * Header map (-wc-header-map)
+ *
+ * A clang header map (the format Xcode uses for -I<file>.hmap)
+ * of every header below the system include directories, passed
+ * with -isystem in front of them. Clang finds a header with one
+ * hash lookup in the map instead of probing every directory.
+ *
+ * Names found in more than one directory stay out of the map,
+ * they are shadowed on purpose (#include_next) and are left to
+ * the regular directory search. The map is rebuilt when the
+ * mtime of any directory it indexed changes.
+ */
+
+static constexpr char HEADERMAPVERSION[] = "1";
+static constexpr int HEADERMAPMAXDEPTH = 16;
+
+static constexpr uint32_t HMAP_MAGIC = 0x686D6170; /* 'hmap' */
+static constexpr uint16_t HMAP_VERSION = 1;
+static constexpr size_t HMAP_HEADERSIZE = 24;
+static constexpr size_t HMAP_BUCKETSIZE = 12;
+
+typedef std::pair<std::string, bool> dirent_pair; /* name, is a directory */
+static std::vector<dirent_pair> *headerdirentries;
+
+static bool collectheaderdirentry(int dirfd, const char *file, unsigned char type)
+{
+    struct stat st;
+
+#ifdef DT_DIR
+    if (type == DT_DIR || type == DT_REG)
+    {
+        headerdirentries->push_back(dirent_pair(file, type == DT_DIR));
+        return false;
+    }
+
+    if (!maybedirectory(type))
+        return false;
+#endif
+
+    ++statcalls;
+
+    if (!fstatat(dirfd, file, &st, 0) && (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)))
+        headerdirentries->push_back(dirent_pair(file, S_ISDIR(st.st_mode)));
+
+    return false;
+}
+
+static void indexheaderdir(const string_vector &dirs, const std::string &root,
+                           const std::string &subdir, int depth, std::ostream &stamps,
+                           string_vector &headers)
+{
+    std::vector<dirent_pair> entries;
+    std::string dir = root + "/" + subdir;
+
+    /* before listing it, a change while listing invalidates the map */
+    writestamp(stamps, subdir.empty() ? root : dir.substr(0, dir.size()-1));
+
+    headerdirentries = &entries;
+
+    if (!listfiles(dir.c_str(), nullptr, collectheaderdirentry))
+        return;
+
+    for (const auto &entry : entries)
+    {
+        if (!entry.second)
+        {
+            headers.push_back(subdir + entry.first);
+            continue;
+        }
+
+        /* include/c++/<version> is indexed on its own */
+        if (depth < HEADERMAPMAXDEPTH &&
+            std::find(dirs.begin(), dirs.end(), dir + entry.first) == dirs.end())
+        {
+            indexheaderdir(dirs, root, subdir + entry.first + "/", depth+1, stamps, headers);
+        }
+    }
+}
+
+static uint32_t hashheadermapkey(const std::string &key)
+{
+    uint32_t h = 0;
+
+    for (unsigned char c : key)
+        h += std::tolower(c) * 13;
+
+    return h;
+}
+
+static void putuint(std::string &out, size_t pos, uint32_t value)
+{
+    std::memcpy(&out[pos], &value, sizeof(value));
+}
+
+static bool buildheadermap(const string_vector &dirs, std::ostream &stamps,
+                           std::string &hmap)
+{
+    struct headermapentry {
+        std::string key;
+        size_t dir;
+        bool shadowed;
+    };
+
+    std::map<std::string, headermapentry> entries; /* lowercase key -> entry */
+    string_vector headers;
+    std::string strings(1, '\0'); /* offset 0 marks an empty bucket */
+    std::vector<uint32_t> prefixes;
+    size_t maxvaluelength = 0;
+    size_t nentries = 0;
+    uint32_t nbuckets = 1;
+
+    for (size_t i = 0; i < dirs.size(); ++i)
+    {
+        headers.clear();
+        indexheaderdir(dirs, dirs[i], "", 0, stamps, headers);
+
+        for (const auto &header : headers)
+        {
+            std::string key = header;
+
+            /* clang compares the keys case-insensitively */
+            for (char &c : key) c = std::tolower(static_cast<unsigned char>(c));
+
+            auto it = entries.find(key);
+
+            if (it != entries.end())
+            {
+                it->second.shadowed = true;
+                continue;
+            }
+
+            entries[key] = { header, i, false };
+        }
+
+        prefixes.push_back(strings.size());
+        strings += dirs[i] + "/";
+        strings += '\0';
+    }
+
+    for (const auto &entry : entries)
+        if (!entry.second.shadowed) ++nentries;
+
+    if (!nentries)
+        return false;
+
+    /* at most half full, the probing is linear */
+    while (nbuckets < nentries * 2)
+        nbuckets *= 2;
+
+    hmap.assign(HMAP_HEADERSIZE + nbuckets * HMAP_BUCKETSIZE, '\0');
+
+    for (const auto &entry : entries)
+    {
+        const headermapentry &e = entry.second;
+
+        if (e.shadowed)
+            continue;
+
+        uint32_t key = strings.size();
+        uint32_t bucket = hashheadermapkey(e.key) & (nbuckets-1);
+        size_t pos;
+
+        strings += e.key;
+        strings += '\0';
+
+        for (;;)
+        {
+            uint32_t used;
+
+            pos = HMAP_HEADERSIZE + bucket * HMAP_BUCKETSIZE;
+            std::memcpy(&used, &hmap[pos], sizeof(used));
+
+            if (!used)
+                break;
+
+            bucket = (bucket+1) & (nbuckets-1);
+        }
+
+        /* key, prefix (the directory), suffix (the key in its original case) */
+        putuint(hmap, pos, key);
+        putuint(hmap, pos+4, prefixes[e.dir]);
+        putuint(hmap, pos+8, key);
+
+        maxvaluelength = std::max(maxvaluelength, dirs[e.dir].size() + 1 + e.key.size());
+    }
+
+    uint16_t version = HMAP_VERSION;
+
+    putuint(hmap, 0, HMAP_MAGIC);
+    std::memcpy(&hmap[4], &version, sizeof(version));
+    putuint(hmap, 8, hmap.size());
+    putuint(hmap, 12, nentries);
+    putuint(hmap, 16, nbuckets);
+    putuint(hmap, 20, maxvaluelength);
+
+    hmap += strings;
+    return true;
+}
+
+/*
+ * Case-insensitive VFS overlay (-wc-case-insensitive)
+ *
+ * Every system include directory is overlaid with a
+ * case-insensitive view of itself, so <Windows.h> finds
+ * windows.h in the same directory it is in. Of files
+ * which only differ in case, the lowercase one wins.
+ */
+
+static bool buildcaseinsensitiveoverlay(const string_vector &dirs, std::ostream &stamps,
+                                        std::string &overlay)
+{
+    string_vector headers;
+
+    overlay = "{\"version\":0,\"case-sensitive\":\"false\",\"roots\":[";
+
+    for (size_t i = 0; i < dirs.size(); ++i)
+    {
+        std::map<std::string, std::string> files; /* lowercase -> name */
+        string_vector open;
+        std::vector<bool> first(1, true);
+
+        headers.clear();
+        indexheaderdir(dirs, dirs[i], "", 0, stamps, headers);
+
+        for (const auto &header : headers)
+        {
+            std::string key = header;
+            for (char &c : key) c = std::tolower(static_cast<unsigned char>(c));
+            auto it = files.insert(std::make_pair(key, header));
+
+            /* lowercase letters sort after uppercase ones */
+            if (!it.second && header > it.first->second)
+                it.first->second = header;
+        }
+
+        string_vector names;
+
+        for (const auto &f : files)
+            names.push_back(f.second);
+
+        /* the entries of a directory must be adjacent */
+        std::sort(names.begin(), names.end());
+
+        if (i) overlay += ",";
+        overlay += "\n{\"type\":\"directory\",\"name\":\"" + jsonescape(dirs[i]) +
+                   "\",\"contents\":[";
+
+        for (const auto &name : names)
+        {
+            string_vector components;
+            size_t pos = 0, end;
+
+            while ((end = name.find('/', pos)) != std::string::npos)
+            {
+                components.push_back(name.substr(pos, end-pos));
+                pos = end+1;
+            }
+
+            size_t common = 0;
+
+            while (common < open.size() && common < components.size() &&
+                   open[common] == components[common])
+            {
+                ++common;
+            }
+
+            for (; open.size() > common; open.pop_back(), first.pop_back())
+                overlay += "]}";
+
+            for (; open.size() < components.size(); open.push_back(components[open.size()]))
+            {
+                if (!first.back()) overlay += ",";
+                first.back() = false;
+                first.push_back(true);
+
+                overlay += "\n{\"type\":\"directory\",\"name\":\"" +
+                           jsonescape(components[open.size()]) + "\",\"contents\":[";
+            }
+
+            if (!first.back()) overlay += ",";
+            first.back() = false;
+
+            overlay += "\n{\"type\":\"file\",\"name\":\"" + jsonescape(name.substr(pos)) +
+                       "\",\"external-contents\":\"" + jsonescape(dirs[i] + "/" + name) + "\"}";
+        }
+
+        for (; !open.empty(); open.pop_back())
+            overlay += "]}";
+
+        overlay += "]}";
+    }
+
+    overlay += "\n]}\n";
+    return true;
+}
+
+/*
+ * Header maps and overlays are cached per set of
+ * system include directories
+ */
+
+typedef bool (*headerindexbuilder)(const string_vector &dirs, std::ostream &stamps,
+                                   std::string &content);
+
+static bool getheaderindex(const commandargs &cmdargs, const char *type,
+                           headerindexbuilder build, std::string &file)
+{
+    std::string dir;
+    std::string key;
+    std::string content;
+    std::string index;
+    std::ostringstream stamps;
+    string_vector dirs;
+    filelock lck;
+
+    if (!getcachedir(dir, "headermap"))
+        return false;
+
+    for (const auto *paths : { &cmdargs.intrinpaths, &cmdargs.cxxpaths, &cmdargs.stdpaths })
+        dirs.insert(dirs.end(), paths->begin(), paths->end());
+
+    key  = "wclang-headermap ";
+    key += HEADERMAPVERSION;
+    key += "\ntype ";
+    key += type;
+    key += "\n";
+
+    for (const auto &d : dirs)
+        key += "dir " + d + "\n";
+
+    std::string base = dir + "/" + hashtostring(hashstring(key));
+    file = base + "." + type;
+
+    auto isvalid = [&]() -> bool
+    {
+        std::string tag;
+
+        if (!readfile((base + ".stamps").c_str(), content) ||
+            content.compare(0, key.size(), key))
+        {
+            return false;
+        }
+
+        std::istringstream in(content.substr(key.size()));
+
+        while (in >> tag)
+            if (tag != "stamp" || !checkstamp(in)) return false;
+
+        return fileexists(file.c_str());
+    };
+
+    if (isvalid())
+        return true;
+
+    if (!mkdirs(dir) || !lck.lock(base + ".lock"))
+        return false;
+
+    /* someone else may have rebuilt it while we were waiting */
+    if (isvalid())
+        return true;
+
+    stamps << key;
+
+    if (!build(dirs, stamps, index))
+        return false;
+
+    return writefileatomic(file, index) &&
+           writefileatomic(base + ".stamps", stamps.str());
+}
+
+bool getheadermap(const commandargs &cmdargs, std::string &file)
+{
+    return getheaderindex(cmdargs, "hmap", buildheadermap, file);
+}
+
+bool getcaseinsensitiveoverlay(const commandargs &cmdargs, std::string &file)
+{
+    return getheaderindex(cmdargs, "yaml", buildcaseinsensitiveoverlay, file);
+}
+
+/*
+ * Clang modules (-wc-modules)
+ *
+ * Neither mingw-w64 nor libstdc++ ship module maps. A module
+ * map naming every configured header by its absolute path is
+ * generated into the cache instead and loaded with
+ * -fmodule-map-file, the toolchain is left as it is.
+ *
+ * Clang validates a module against every header it was built
+ * from and rebuilds it when one of them changed. The object
+ * cache does not take compiles with -fmodules, their
+ * preprocessor output only shows the module import and not
+ * the headers behind it.
+ *
+ * Compiled modules are kept per target and clang version and
+ * pruned like the ThinLTO cache, with WCLANG_MODULES_CACHE_SIZE
+ * and WCLANG_MODULES_CACHE_AGE.
+ */
+
+static constexpr char MODULEMAPVERSION[] = "1";
+static constexpr ullong MODULESCACHESIZE = 1ULL * 1024 * 1024 * 1024;
+static constexpr long MODULESCACHEAGE = 7; /* days */
+
+/*
+ * The CRT and libstdc++ headers are full of include_next
+ * and macro switches, only windows.h is a module by default
+ */
+
+static constexpr const char* DEFAULTMODULEHEADERS[] = { "windows.h" };
+
+/*
+ * A module is built with the macros of the command line only,
+ * clang warns if one of these is #defined in front of the import
+ */
+
+struct moduleconfigmacros {
+    const char *header;
+    const char *macros;
+};
+
+static constexpr moduleconfigmacros MODULECONFIGMACROS[] = {
+    { "windows.h", "UNICODE, _UNICODE, STRICT, NOMINMAX, WIN32_LEAN_AND_MEAN, "
+                   "WINVER, _WIN32_WINNT, _WIN32_IE, NTDDI_VERSION" },
+    { "stdio.h", "__USE_MINGW_ANSI_STDIO" },
+    { "math.h", "_USE_MATH_DEFINES" }
+};
+
+static std::string getmodulename(const std::string &header)
+{
+    std::string name = "wclang_";
+
+    for (char c : header)
+        name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+
+    return name;
+}
+
+bool getmodulemap(const commandargs &cmdargs, std::string &file, std::string &cachepath)
+{
+    std::string dir;
+    std::string map;
+    string_vector headers;
+    size_t modules = 0;
+
+    if (!getcachedir(dir, "modules"))
+        return false;
+
+    getheaderlist(cmdargs.settings.modulesheaders, DEFAULTMODULEHEADERS, headers);
+
+    map  = "// wclang-modulemap ";
+    map += MODULEMAPVERSION;
+    map += "\n";
+
+    for (const auto &header : headers)
+    {
+        std::string path;
+
+        /* the one -isystem would find */
+        for (const auto *paths : { &cmdargs.intrinpaths, &cmdargs.cxxpaths, &cmdargs.stdpaths })
+        {
+            for (const auto &d : *paths)
+            {
+                if (fileexists((d + "/" + header).c_str()))
+                {
+                    path = d + "/" + header;
+                    break;
+                }
+            }
+
+            if (!path.empty())
+                break;
+        }
+
+        if (path.empty())
+        {
+            std::cerr << "warning: -wc-modules: cannot find header '"
+                      << header << "'" << std::endl;
+            continue;
+        }
+
+        map += "\nmodule " + getmodulename(header) + " [system] {\n";
+        map += "  header \"" + path + "\"\n";
+        map += "  export *\n";
+
+        for (const auto &config : MODULECONFIGMACROS)
+        {
+            if (header == config.header)
+                map += "  config_macros " + std::string(config.macros) + "\n";
+        }
+
+        map += "}\n";
+        ++modules;
+    }
+
+    if (modules == 0)
+        return false;
+
+    file = dir + "/" + hashtostring(hashstring(map)) + ".modulemap";
+    cachepath = dir + "/" + cmdargs.target + "-" + cmdargs.clangversion.str();
+
+    if (!mkdirs(cachepath) || (!fileexists(file.c_str()) && !writefileatomic(file, map)))
+        return false;
+
+    prunecachedir(cachepath, "WCLANG_MODULES_CACHE_SIZE", MODULESCACHESIZE,
+                  "WCLANG_MODULES_CACHE_AGE", MODULESCACHEAGE);
+
+    return true;
+}
+
+/*
+ * Import libraries (-wc-import=<file.def>)
+ *
+ * An import library generated from a .def file is cached by the
+ * content and name of the .def file (the DLL name without a
+ * LIBRARY line), the dlltool binary and its command (which names
+ * the target machine), a link reuses it instead of running
+ * dlltool again.
+ */
+
+static constexpr char IMPORTLIBVERSION[] = "2";
+
+bool getimportlibrary(const std::string &def, const string_vector &dlltool,
+                      std::string &lib, std::string &err)
+{
+    std::string dir;
+    std::string key;
+    std::string content;
+    string_vector args;
+
+    if (!readfile(def.c_str(), content))
+    {
+        err = "cannot read " + def + "\n";
+        return false;
+    }
+
+    if (!getcachedir(dir, "importlib"))
+        return false;
+
+    key  = "wclang-importlib ";
+    key += IMPORTLIBVERSION;
+    key += "\n";
+
+    key += "tool " + fileidentity(dlltool[0].c_str()) + "\n";
+
+    for (const auto &arg : dlltool)
+        key += "arg " + arg + "\n";
+
+    key += "file ";
+    key += getfileName(def.c_str());
+    key += "\n";
+    key += content;
+    lib = dir + "/" + hashtostring(hashstring(key)) + ".a";
+
+    if (fileexists(lib.c_str()))
+        return true;
+
+    if (!mkdirs(dir))
+        return false;
+
+    std::stringstream tmp;
+    tmp << lib << ".tmp." << getpid();
+
+    args = dlltool;
+    args.push_back("-d");
+    args.push_back(def);
+    args.push_back("-l");
+    args.push_back(tmp.str());
+
+    std::vector<char*> cargs;
+
+    for (auto &arg : args)
+        cargs.push_back(&arg[0]);
+
+    cargs.push_back(nullptr);
+
+    if (runprocess(cargs.data(), nullptr, &err) != 0 ||
+        rename(tmp.str().c_str(), lib.c_str()))
+    {
+        unlink(tmp.str().c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,147 @@
+/*
+ * Persistent on-disk caches
+ */
+
+constexpr ullong HASH_INIT = 0xcbf29ce484222325ULL;
+
+ullong hashbytes(const void *data, size_t len, ullong h = HASH_INIT);
+ullong hashstring(const std::string &str, ullong h = HASH_INIT);
+std::string hashtostring(ullong h);
+
+/*
+ * FNV-1a 128 bit, used for content addressing
+ */
+
+class hash128 {
+public:
+    hash128() : lo(0x62b821756295c58dULL), hi(0x6c62272e07bb0142ULL) {}
+
+    void update(const void *data, size_t len);
+    void update(const std::string &str) { update(str.c_str(), str.size()+1); }
+    std::string str() const { return hashtostring(hi) + hashtostring(lo); }
+
+private:
+    ullong lo;
+    ullong hi;
+};
+
+bool getcachedir(std::string &dir, const char *subdir = nullptr);
+bool mkdirs(const std::string &dir);
+bool readfile(const char *file, std::string &content);
+bool writefileatomic(const std::string &file, const std::string &content);
+
+std::string fileidentity(const char *file);
+bool runcommandcached(const std::string &command, const std::string &binary,
+                      std::string &output);
+
+class filelock {
+public:
+    filelock() : fd(-1) {}
+    ~filelock() { unlock(); }
+
+    bool lock(const std::string &file, bool exclusive = true);
+    void unlock();
+
+private:
+    filelock(const filelock &) = delete;
+    filelock &operator=(const filelock &) = delete;
+    int fd;
+};
+
+/*
+ * Stores the result of the toolchain discovery
+ * (target, include paths, compiler versions and
+ * binary paths).
+ *
+ * The cache is keyed by the invocation name, PATH
+ * and MINGW_PATH, and validated by the inode and
+ * mtime of every directory it resolved.
+ *
+ * pin() keeps the validated entry in memory, the
+ * processes forked by -wc-batch load it from there
+ * without validating it again. keepvalidated() does
+ * the same for wclangd, but validates the entry again
+ * once it is older than 'interval' seconds.
+ */
+
+class toolchaincache {
+public:
+    toolchaincache(const char *invocationname);
+
+    bool load(commandargs &cmdargs, int &targettype);
+    bool preload();
+    bool pin();
+    bool keepvalidated(time_t interval);
+    bool lock();
+    void unlock();
+    void store(const commandargs &cmdargs, int targettype);
+
+private:
+    std::string key;
+    std::string file;
+    filelock lck;
+    bool enabled;
+};
+
+/*
+ * Object cache (-wc-cache)
+ *
+ * Keyed by the preprocessed translation unit and the
+ * final compiler arguments
+ */
+
+constexpr int OBJECTCACHE_UNCACHEABLE = -1;
+
+int runcachedcompile(const std::string &compiler, char **cargs,
+                     const buildsettings &settings);
+void printobjectcachestats();
+
+/*
+ * Automatic precompiled headers (-wc-auto-pch)
+ *
+ * Inserts -include-pch into the compiler arguments if
+ * the source file starts with headers of the PCH set
+ */
+
+void useautopch(const std::string &compiler, char **&cargs, const std::string &headers);
+
+/*
+ * ThinLTO cache (-wc-thinlto)
+ *
+ * One directory per target, pruned by age and
+ * size before the link
+ */
+
+bool getthinltocachedir(const std::string &target, std::string &dir);
+void prunethinltocache(const std::string &dir);
+
+/*
+ * Header map (-wc-header-map) and case-insensitive
+ * VFS overlay (-wc-case-insensitive)
+ *
+ * One of each per set of system include directories,
+ * rebuilt when one of the directories changes
+ */
+
+bool getheadermap(const commandargs &cmdargs, std::string &file);
+bool getcaseinsensitiveoverlay(const commandargs &cmdargs, std::string &file);
+
+/*
+ * Clang modules (-wc-modules)
+ *
+ * A generated module map of the configured system headers
+ * and the module cache directory of the target and clang
+ * version, pruned by age and size
+ */
+
+bool getmodulemap(const commandargs &cmdargs, std::string &file, std::string &cachepath);
+
+/*
+ * Import libraries (-wc-import)
+ *
+ * The import library of a .def file, generated by
+ * the given dlltool command and cached by content
+ */
+
+bool getimportlibrary(const std::string &def, const string_vector &dlltool,
+                      std::string &lib, std::string &err);
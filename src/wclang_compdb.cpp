@@ -0,0 +1,263 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include "wclang.h"
+#include "wclang_cache.h"
+#include "wclang_options.h"
+#include "wclang_compdb.h"
+
+/*
+ * A record is one line holding one database entry, the
+ * directory, file and output fields come first and form
+ * the key the compaction deduplicates by (last one wins)
+ */
+
+static constexpr char ARGUMENTSFIELD[] = ",\"arguments\":[";
+
+static constexpr const char* SOURCEEXTENSIONS[] = {
+    ".c", ".cc", ".cp", ".cpp", ".cxx", ".c++", ".C", ".CPP", ".i", ".ii", ".m", ".mm", ".S"
+};
+
+static bool issourcefile(const char *file)
+{
+    const char *ext = std::strrchr(file, '.');
+
+    if (!ext)
+        return false;
+
+    for (const char *e : SOURCEEXTENSIONS)
+        if (!std::strcmp(ext, e)) return true;
+
+    return false;
+}
+
+static std::string getlogfile(const char *db)
+{
+    return std::string(db) + ".log";
+}
+
+static bool appendfile(const std::string &file, const std::string &content)
+{
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) == -1)
+        return false;
+
+    while ((n = write(fd, content.c_str(), content.size())) == -1 && errno == EINTR);
+    close(fd);
+
+    return n == static_cast<ssize_t>(content.size());
+}
+
+void recordcompilecommand(const char *db, const std::string &compiler, char **cargs)
+{
+    std::vector<char**> sources;
+    std::string output;
+    std::string records;
+    char cwd[PATH_MAX];
+
+    for (char **arg = cargs+1; *arg; ++arg)
+    {
+        const char *value;
+        const optioninfo *opt;
+
+        if (**arg != '-')
+        {
+            if (issourcefile(*arg)) sources.push_back(arg);
+            continue;
+        }
+
+        if (!(opt = findoption(*arg, &value)))
+            continue;
+
+        if ((opt->flags & OPT_SEPARATE) && !*value && arg[1])
+            value = *++arg;
+
+        if (opt->id == optionid::output)
+            output = value;
+    }
+
+    if (sources.empty() || !getcwd(cwd, sizeof(cwd)))
+        return;
+
+    /*
+     * One entry per source file, without the other
+     * sources of the same invocation
+     */
+
+    for (char **source : sources)
+    {
+        std::string record;
+
+        record += "{\"directory\":\"" + jsonescape(cwd) + "\"";
+        record += ",\"file\":\"" + jsonescape(*source) + "\"";
+
+        if (sources.size() == 1 && !output.empty())
+            record += ",\"output\":\"" + jsonescape(output) + "\"";
+
+        record += ARGUMENTSFIELD;
+        record += "\"" + jsonescape(compiler) + "\"";
+
+        for (char **arg = cargs+1; *arg; ++arg)
+        {
+            if (arg != source &&
+                std::find(sources.begin(), sources.end(), arg) != sources.end())
+            {
+                continue;
+            }
+
+            record += ",\"" + jsonescape(*arg) + "\"";
+        }
+
+        record += "]}\n";
+        records += record;
+    }
+
+    /*
+     * O_APPEND writes are atomic with respect to the
+     * file offset, a single write() never interleaves
+     * with the records of other processes
+     */
+
+    appendfile(getlogfile(db), records);
+}
+
+/*
+ * Returns the number of lines that are not records
+ */
+
+static size_t readrecords(const std::string &file, string_vector &keys,
+                          std::map<std::string, std::string> &records)
+{
+    std::ifstream f(file.c_str());
+    std::string line;
+    size_t invalid = 0;
+
+    while (std::getline(f, line))
+    {
+        size_t pos;
+
+        if (line.empty() || line == "[" || line == "]")
+            continue;
+
+        if (line[line.size()-1] == ',')
+            line.resize(line.size()-1);
+
+        /* incomplete records of crashed writers are dropped */
+        if (line.size() < 2 || line[0] != '{' || line.compare(line.size()-2, 2, "]}") ||
+            (pos = line.find(ARGUMENTSFIELD)) == std::string::npos)
+        {
+            ++invalid;
+            continue;
+        }
+
+        std::string key = line.substr(0, pos);
+        auto it = records.find(key);
+
+        if (it == records.end())
+            keys.push_back(key);
+
+        records[key].swap(line);
+    }
+
+    return invalid;
+}
+
+int compactcompdb(const char *db)
+{
+    std::map<std::string, std::string> records;
+    string_vector keys;
+    std::string log = getlogfile(db);
+    std::string tmp;
+    std::string json;
+    filelock lck;
+
+    if (!lck.lock(std::string(db) + ".lock"))
+    {
+        std::cerr << "cannot lock " << db << ".lock" << std::endl;
+        return 1;
+    }
+
+    /*
+     * Only a database written by the compaction is read
+     * back, one generated by other tools (e.g. CMake's
+     * pretty-printed one) would be lost
+     */
+
+    if (readrecords(db, keys, records))
+    {
+        std::cerr << db << " was not written by wclang, not overwriting it" << std::endl;
+        return 1;
+    }
+
+    /*
+     * Take the log away from the writers, records appended
+     * from now on go to a new log for the next compaction
+     */
+
+    tmp = log + ".compacting";
+
+    if (rename(log.c_str(), tmp.c_str()) && errno != ENOENT)
+    {
+        std::cerr << "cannot rename " << log << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    readrecords(tmp, keys, records);
+
+    json = "[\n";
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        json += records[keys[i]];
+        json += i + 1 < keys.size() ? ",\n" : "\n";
+    }
+
+    json += "]\n";
+
+    if (!writefileatomic(db, json))
+    {
+        std::cerr << "cannot write " << db << std::endl;
+
+        /*
+         * Writers may have created a new log meanwhile,
+         * hand the records back by appending them to it
+         */
+
+        if (readfile(tmp.c_str(), json) && appendfile(log, json))
+            unlink(tmp.c_str());
+
+        return 1;
+    }
+
+    unlink(tmp.c_str());
+    return 0;
+}
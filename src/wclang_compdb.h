@@ -0,0 +1,11 @@
+/*
+ * Compilation database (-wc-compdb=<file>)
+ *
+ * Every compile step appends one record to <file>.log with a
+ * single O_APPEND write, parallel builds never wait for each
+ * other. -wc-compdb-compact=<file> merges the records into
+ * <file> (compile_commands.json format).
+ */
+
+void recordcompilecommand(const char *db, const std::string &compiler, char **cargs);
+int compactcompdb(const char *db);
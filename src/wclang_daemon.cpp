@@ -0,0 +1,764 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "wclang.h"
+#include "wclang_cache.h"
+#include "wclang_daemon.h"
+
+extern char **environ;
+
+/*
+ * Protocol:
+ *
+ * client -> daemon: one byte carrying the client's stdout and
+ *                   stderr (SCM_RIGHTS), then a message with
+ *                   argv, cwd and the environment
+ *
+ * daemon -> client: a message with either MSG_EXEC, the compiler,
+ *                   its arguments, the environment to execute
+ *                   it with and the settings (-wc-*) to run it
+ *                   with, or MSG_EXIT and an exit code
+ *
+ * Every message is prefixed with its length, every string
+ * and every list of strings with its length / size.
+ */
+
+static constexpr char MSG_EXEC = 'x';
+static constexpr char MSG_EXIT = 'e';
+static constexpr uint32_t MAXMESSAGESIZE = 64*1024*1024;
+
+static volatile sig_atomic_t stopdaemon = 0;
+
+/*
+ * Tools
+ */
+
+static bool writeall(int fd, const char *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, data, len);
+
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static bool readall(int fd, char *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = read(fd, data, len);
+
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        if (!n)
+            return false;
+
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+void putint(std::string &msg, uint32_t val)
+{
+    msg.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+void putstring(std::string &msg, const char *str, size_t len)
+{
+    putint(msg, len);
+    msg.append(str, len);
+}
+
+void putstrings(std::string &msg, char **strs)
+{
+    uint32_t n = 0;
+
+    for (char **p = strs; *p; ++p) ++n;
+    putint(msg, n);
+
+    for (char **p = strs; *p; ++p)
+        putstring(msg, *p, std::strlen(*p));
+}
+
+bool getint(const std::string &msg, size_t &pos, uint32_t &val)
+{
+    if (msg.size() - pos < sizeof(val))
+        return false;
+
+    std::memcpy(&val, msg.c_str() + pos, sizeof(val));
+    pos += sizeof(val);
+    return true;
+}
+
+bool getstring(const std::string &msg, size_t &pos, std::string &str)
+{
+    uint32_t len;
+
+    if (!getint(msg, pos, len) || msg.size() - pos < len)
+        return false;
+
+    str.assign(msg, pos, len);
+    pos += len;
+    return true;
+}
+
+bool getstrings(const std::string &msg, size_t &pos, string_vector &strs)
+{
+    uint32_t n;
+
+    if (!getint(msg, pos, n))
+        return false;
+
+    strs.clear();
+    strs.resize(n);
+
+    for (auto &str : strs)
+        if (!getstring(msg, pos, str)) return false;
+
+    return true;
+}
+
+bool sendmessage(int fd, const std::string &msg)
+{
+    std::string buf;
+
+    putint(buf, msg.size());
+    buf += msg;
+
+    return writeall(fd, buf.c_str(), buf.size());
+}
+
+bool recvmessage(int fd, std::string &msg)
+{
+    uint32_t len;
+
+    if (!readall(fd, reinterpret_cast<char*>(&len), sizeof(len)) ||
+        len > MAXMESSAGESIZE)
+    {
+        return false;
+    }
+
+    msg.resize(len);
+    return !len || readall(fd, &msg[0], len);
+}
+
+static bool sendfds(int fd, const int *fds, int count)
+{
+    char byte = 0;
+    char buf[CMSG_SPACE(sizeof(int) * 2)];
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+
+    if (count > 2)
+        return false;
+
+    std::memset(&mh, 0, sizeof(mh));
+    std::memset(buf, 0, sizeof(buf));
+
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = buf;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    while (sendmsg(fd, &mh, 0) == -1)
+        if (errno != EINTR) return false;
+
+    return true;
+}
+
+static bool recvfds(int fd, int *fds, int count)
+{
+    char byte;
+    char buf[CMSG_SPACE(sizeof(int) * 2)];
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    if (count > 2)
+        return false;
+
+    std::memset(&mh, 0, sizeof(mh));
+
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = buf;
+    mh.msg_controllen = sizeof(buf);
+
+    while ((n = recvmsg(fd, &mh, 0)) == -1)
+        if (errno != EINTR) return false;
+
+    cmsg = CMSG_FIRSTHDR(&mh);
+
+    if (n != 1 || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count))
+    {
+        return false;
+    }
+
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+    return true;
+}
+
+bool getsocketaddress(const std::string &path, struct sockaddr_un &addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+int connectsocket(const std::string &path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!getsocketaddress(path, addr))
+        return -1;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        return -1;
+
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+static char **tocargs(string_vector &strs)
+{
+    char **cargs = new char* [strs.size()+1];
+    size_t i = 0;
+
+    for (auto &str : strs)
+        cargs[i++] = &str[0];
+
+    cargs[i] = nullptr;
+    return cargs;
+}
+
+bool getdaemonsocket(std::string &path)
+{
+    const char *p;
+    struct sockaddr_un addr;
+
+    if ((p = getenv("WCLANG_DAEMON_SOCKET")) && *p)
+    {
+        path = p;
+    }
+    else
+    {
+        if (!getcachedir(path))
+            return false;
+
+        path += "/wclangd.sock";
+    }
+
+    return getsocketaddress(path, addr);
+}
+
+/*
+ * buildsettings
+ */
+
+static void putsettings(std::string &msg, const buildsettings &settings)
+{
+    for (bool flag : { settings.autopch, settings.objectcache, settings.distribute,
+                       settings.failfast, settings.caseinsensitive, settings.headermap,
+                       settings.modules })
+    {
+        putint(msg, flag);
+    }
+
+    putint(msg, settings.jobs);
+    putint(msg, settings.linkthreads);
+
+    for (const std::string *str : { &settings.autopchheaders, &settings.compdb,
+                                    &settings.workers, &settings.distributeclang,
+                                    &settings.rccompiler, &settings.rctarget,
+                                    &settings.modulesheaders })
+    {
+        putstring(msg, str->c_str(), str->size());
+    }
+}
+
+static bool getsettings(const std::string &msg, size_t &pos, buildsettings &settings)
+{
+    uint32_t val;
+
+    for (bool *flag : { &settings.autopch, &settings.objectcache, &settings.distribute,
+                        &settings.failfast, &settings.caseinsensitive, &settings.headermap,
+                        &settings.modules })
+    {
+        if (!getint(msg, pos, val))
+            return false;
+
+        *flag = val;
+    }
+
+    for (long *num : { &settings.jobs, &settings.linkthreads })
+    {
+        if (!getint(msg, pos, val))
+            return false;
+
+        *num = val;
+    }
+
+    for (std::string *str : { &settings.autopchheaders, &settings.compdb,
+                              &settings.workers, &settings.distributeclang,
+                              &settings.rccompiler, &settings.rctarget,
+                              &settings.modulesheaders })
+    {
+        if (!getstring(msg, pos, *str))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Client
+ */
+
+bool rundaemonclient(int argc, char **argv, std::string &compiler, char **&cargs,
+                     buildsettings &settings)
+{
+    static constexpr int fds[] = { STDOUT_FILENO, STDERR_FILENO };
+    static string_vector args; /* referenced by cargs and environ */
+    static string_vector env;
+    std::string path;
+    std::string msg;
+    char cwd[PATH_MAX];
+    const char *p;
+    size_t pos = 1;
+    uint32_t status;
+    int fd;
+
+    if ((p = getenv("WCLANG_NO_DAEMON")) && *p != '0')
+        return false;
+
+    if (!getdaemonsocket(path) || !getcwd(cwd, sizeof(cwd)))
+        return false;
+
+    if ((fd = connectsocket(path)) == -1)
+        return false; /* not running, build the command ourselves */
+
+    /* a hanging daemon must not hang the build */
+    struct timeval tv = { 10, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    putstrings(msg, argv);
+    putstring(msg, cwd, std::strlen(cwd));
+    putstrings(msg, environ);
+
+    if (!sendfds(fd, fds, 2) || !sendmessage(fd, msg) || !recvmessage(fd, msg) ||
+        msg.empty())
+    {
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+
+    switch (msg[0])
+    {
+        case MSG_EXIT:
+        {
+            if (getint(msg, pos, status))
+                std::exit(status);
+            break;
+        }
+        case MSG_EXEC:
+        {
+            if (!getstring(msg, pos, compiler) || !getstrings(msg, pos, args) ||
+                !getstrings(msg, pos, env) || !getsettings(msg, pos, settings))
+            {
+                break;
+            }
+
+            environ = tocargs(env);
+            cargs = tocargs(args);
+            return true;
+        }
+    }
+
+    /* malformed response, fall back to the in-process path */
+    return false;
+}
+
+/*
+ * Daemon
+ */
+
+/*
+ * A toolchain is validated (stamps) by the daemon at most every
+ * DAEMONVALIDATEINTERVAL, the request handlers it forks use the
+ * validated copy without looking at the file system again
+ */
+
+static constexpr time_t DAEMONVALIDATEINTERVAL = 1; /* seconds */
+
+/*
+ * Exit code of a request handler which has sent its response,
+ * any other one is passed on to the client (MSG_EXIT)
+ */
+
+static constexpr int HANDLER_REPLIED = 255;
+
+static std::map<pid_t, int> pendingrequests; /* handler -> connection */
+static int childpipe[2] = { -1, -1 };
+
+/*
+ * The socket path can be anywhere (WCLANG_DAEMON_SOCKET),
+ * only serve processes of our own user
+ */
+
+static bool istrustedpeer(int conn)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    return !getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) &&
+           cred.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+
+    return !getpeereid(conn, &uid, &gid) && uid == geteuid();
+#endif
+}
+
+static void handlerequest(int conn, buildcommandfun buildcommand,
+                          const buildsettings &settings)
+{
+    int fds[2];
+    std::string msg;
+    string_vector args;
+    string_vector env;
+    std::string cwd;
+    size_t pos = 0;
+    pid_t pid;
+
+    static string_vector clientenv;
+    static std::vector<char*> clientenviron;
+
+    if (!recvfds(conn, fds, 2))
+    {
+        close(conn);
+        return;
+    }
+
+    if (!recvmessage(conn, msg) || !getstrings(msg, pos, args) ||
+        !getstring(msg, pos, cwd) || !getstrings(msg, pos, env) || args.empty())
+    {
+        close(fds[0]);
+        close(fds[1]);
+        close(conn);
+        return;
+    }
+
+    /*
+     * Switch to the client's environment, so the toolchain
+     * cache key matches, and keep the resolved toolchain in
+     * memory for all further requests
+     */
+
+    clientenv.swap(env);
+    clientenviron.clear();
+
+    for (auto &var : clientenv)
+        clientenviron.push_back(&var[0]);
+
+    clientenviron.push_back(nullptr);
+    environ = clientenviron.data();
+
+    toolchaincache(getfileName(args[0].c_str())).keepvalidated(DAEMONVALIDATEINTERVAL);
+
+    /*
+     * Build the command in a child process, the command
+     * building code may exit()
+     */
+
+    if ((pid = fork()))
+    {
+        close(fds[0]);
+        close(fds[1]);
+
+        if (pid == -1)
+        {
+            msg = MSG_EXIT;
+            putint(msg, EXIT_FAILURE);
+            sendmessage(conn, msg);
+            close(conn);
+            return;
+        }
+
+        pendingrequests[pid] = conn;
+        return;
+    }
+
+    std::string compiler;
+    char **cargs;
+    int ret;
+
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    close(childpipe[0]);
+    close(childpipe[1]);
+
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+
+    if (chdir(cwd.c_str()))
+        std::exit(EXIT_FAILURE);
+
+    if ((ret = buildcommand(args.size(), tocargs(args), compiler, cargs)))
+        std::exit(ret);
+
+    msg = MSG_EXEC;
+    putstring(msg, compiler.c_str(), compiler.size());
+    putstrings(msg, cargs);
+    putstrings(msg, environ);
+    putsettings(msg, settings);
+
+    sendmessage(conn, msg);
+    _exit(HANDLER_REPLIED);
+}
+
+/*
+ * Answers for the request handlers which exited
+ * without a response
+ */
+
+static void reaprequests()
+{
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        auto it = pendingrequests.find(pid);
+
+        if (it == pendingrequests.end())
+            continue;
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != HANDLER_REPLIED)
+        {
+            std::string msg(1, MSG_EXIT);
+
+            if (WIFEXITED(status)) putint(msg, WEXITSTATUS(status));
+            else putint(msg, 128 + WTERMSIG(status));
+
+            sendmessage(it->second, msg);
+        }
+
+        close(it->second);
+        pendingrequests.erase(it);
+    }
+}
+
+int rundaemon(int argc, char **argv, buildcommandfun buildcommand,
+              const buildsettings &settings)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    std::string path;
+    int fd;
+
+    if (!getdaemonsocket(path) || !getsocketaddress(path, addr))
+    {
+        std::cerr << "wclangd: cannot determine socket path "
+                     "(set WCLANG_DAEMON_SOCKET)" << std::endl;
+        return 1;
+    }
+
+    if ((fd = connectsocket(path)) != -1)
+    {
+        close(fd);
+        std::cerr << "wclangd: already running (" << path << ")" << std::endl;
+        return 1;
+    }
+
+    mkdirs(path.substr(0, path.find_last_of(PATHDIV)));
+    unlink(path.c_str()); /* stale socket */
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        std::cerr << "wclangd: socket() failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    mode_t mask = umask(077);
+
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+        listen(fd, SOMAXCONN))
+    {
+        umask(mask);
+        std::cerr << "wclangd: cannot listen on " << path << ": "
+                  << strerror(errno) << std::endl;
+        close(fd);
+        return 1;
+    }
+
+    umask(mask);
+
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = [](int) { stopdaemon = 1; };
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+
+    /* a finished request handler wakes up the poll() below */
+
+    if (pipe(childpipe))
+    {
+        std::cerr << "wclangd: pipe() failed: " << strerror(errno) << std::endl;
+        close(fd);
+        return 1;
+    }
+
+    for (int p : childpipe)
+        fcntl(p, F_SETFL, fcntl(p, F_GETFL) | O_NONBLOCK);
+
+    sa.sa_handler = [](int)
+    {
+        int olderrno = errno;
+        if (write(childpipe[1], "", 1)) {}
+        errno = olderrno;
+    };
+
+    sigaction(SIGCHLD, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "wclangd: listening on " << path << std::endl;
+
+    while (!stopdaemon)
+    {
+        struct pollfd pfds[2];
+        char buf[64];
+
+        pfds[0].fd = fd;
+        pfds[1].fd = childpipe[0];
+        pfds[0].events = pfds[1].events = POLLIN;
+        pfds[0].revents = pfds[1].revents = 0;
+
+        if (poll(pfds, 2, -1) == -1 && errno != EINTR)
+        {
+            std::cerr << "wclangd: poll() failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        while (read(childpipe[0], buf, sizeof(buf)) > 0);
+        reaprequests();
+
+        if (!(pfds[0].revents & POLLIN))
+            continue;
+
+        int conn = accept(fd, nullptr, nullptr);
+
+        if (conn == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+                continue;
+
+            std::cerr << "wclangd: accept() failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if (!istrustedpeer(conn))
+        {
+            std::cerr << "wclangd: rejecting a connection of another user" << std::endl;
+            close(conn);
+            continue;
+        }
+
+        /* don't let a stuck client block everyone else */
+        struct timeval tv = { 5, 0 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        /* closes conn once the request has been answered */
+        handlerequest(conn, buildcommand, settings);
+    }
+
+    for (const auto &request : pendingrequests)
+        close(request.second);
+
+    close(fd);
+    unlink(path.c_str());
+    return 0;
+}
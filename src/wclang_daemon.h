@@ -0,0 +1,32 @@
+/*
+ * wclangd: a resident process which keeps the resolved
+ * toolchains in memory and hands out the final compiler
+ * command over a local socket
+ */
+
+typedef int (*buildcommandfun)(int argc, char **argv, std::string &compiler,
+                               char **&cargs);
+
+bool getdaemonsocket(std::string &path);
+/* settings: where buildcommand leaves the settings of the command */
+int rundaemon(int argc, char **argv, buildcommandfun buildcommand,
+              const buildsettings &settings);
+bool rundaemonclient(int argc, char **argv, std::string &compiler, char **&cargs,
+                     buildsettings &settings);
+
+/*
+ * Length prefixed messages, also spoken
+ * by wclang-worker (wclang_distribute.cpp)
+ */
+
+void putint(std::string &msg, uint32_t val);
+void putstring(std::string &msg, const char *str, size_t len);
+void putstrings(std::string &msg, char **strs);
+bool getint(const std::string &msg, size_t &pos, uint32_t &val);
+bool getstring(const std::string &msg, size_t &pos, std::string &str);
+bool getstrings(const std::string &msg, size_t &pos, string_vector &strs);
+bool sendmessage(int fd, const std::string &msg);
+bool recvmessage(int fd, std::string &msg);
+
+bool getsocketaddress(const std::string &path, struct sockaddr_un &addr);
+int connectsocket(const std::string &path);
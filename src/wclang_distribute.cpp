@@ -0,0 +1,1018 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "wclang.h"
+#include "wclang_time.h"
+#include "wclang_cache.h"
+#include "wclang_daemon.h"
+#include "wclang_options.h"
+#include "wclang_distribute.h"
+
+/*
+ * Protocol (framed like the wclangd messages):
+ *
+ * client -> worker: protocol version, clang version, extension
+ *                   of the preprocessed source (.i / .ii), the
+ *                   compiler arguments and the preprocessed source
+ *
+ * worker -> client: MSG_OBJECT, the exit code, the compiler's
+ *                   stderr and the object file, MSG_MISMATCH
+ *                   and the worker's clang version, or MSG_REJECT
+ *                   if it does not take the compiler arguments
+ */
+
+static constexpr char PROTOCOLVERSION[] = "1";
+static constexpr char MSG_OBJECT = 'o';
+static constexpr char MSG_MISMATCH = 'm';
+static constexpr char MSG_REJECT = 'r';
+static constexpr int CONNECTTIMEOUT = 2000; /* ms */
+static constexpr time_t COMPILETIMEOUT = 600; /* s */
+
+static volatile sig_atomic_t stopworker = 0;
+
+static bool getworkersocket(std::string &path)
+{
+    if (!getcachedir(path))
+        return false;
+
+    path += "/wclang-worker.sock";
+    return true;
+}
+
+static bool isunixsocket(const std::string &worker)
+{
+    return worker.find(PATHDIV) != std::string::npos;
+}
+
+/*
+ * host:port, [v6-address]:port, host or :port
+ */
+
+static void splitaddress(const std::string &worker, std::string &host, std::string &port)
+{
+    size_t pos = worker.find_last_of(':');
+
+    if (pos != std::string::npos && worker.find(']', pos) == std::string::npos)
+    {
+        host = worker.substr(0, pos);
+        port = worker.substr(pos+1);
+    }
+    else
+    {
+        host = worker;
+        port = std::to_string(WORKER_PORT);
+    }
+
+    if (host.size() >= 2 && host[0] == '[' && host[host.size()-1] == ']')
+        host = host.substr(1, host.size()-2);
+}
+
+static int connectworker(const std::string &worker)
+{
+    struct addrinfo hints;
+    struct addrinfo *res;
+    std::string host;
+    std::string port;
+    int fd = -1;
+
+    if (isunixsocket(worker))
+        return connectsocket(worker);
+
+    splitaddress(worker, host, port);
+
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res))
+        return -1;
+
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next)
+    {
+        struct pollfd pfd;
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1)
+            continue;
+
+        /* an unreachable host must not stall the build */
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) && errno != EINPROGRESS)
+        {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+
+        if (poll(&pfd, 1, CONNECTTIMEOUT) != 1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) || error)
+        {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        break;
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+/*
+ * Client
+ */
+
+struct distributeinfo {
+    std::string source;
+    std::string output;
+    std::string depfile;
+    std::string language;
+    const char *extension;
+    bool deps;
+    bool deptarget;
+    bool debug;
+    string_vector ppargs;
+    string_vector ccargs;
+
+    distributeinfo() : extension(), deps(false), deptarget(false), debug(false) {}
+};
+
+static const char *getpreprocessedextension(const distributeinfo &di)
+{
+    static constexpr const char* CXXEXTENSIONS[] = {
+        "cc", "cp", "cxx", "cpp", "CPP", "c++", "C", "ii"
+    };
+
+    if (!di.language.empty())
+    {
+        if (di.language == "c" || di.language == "cpp-output") return ".i";
+        if (di.language == "c++" || di.language == "c++-cpp-output") return ".ii";
+        return nullptr;
+    }
+
+    size_t pos = di.source.find_last_of('.');
+
+    if (pos == std::string::npos)
+        return nullptr;
+
+    const char *ext = di.source.c_str() + pos + 1;
+
+    if (!std::strcmp(ext, "c") || !std::strcmp(ext, "i"))
+        return ".i";
+
+    for (const char *cxxext : CXXEXTENSIONS)
+        if (!std::strcmp(ext, cxxext)) return ".ii";
+
+    return nullptr; /* assembly, objective-c, ... */
+}
+
+/*
+ * The compile flags a worker accepts: code generation, warnings
+ * and the language dialect. Nothing that names a file or runs a
+ * tool on the worker (-o, -Wa,, -Xclang, -fplugin=, ...) and no
+ * inputs. Clients keep other compiles local.
+ */
+
+static constexpr const char* WORKERFLAGS[] = {
+    "-c", "-w", "-ansi", "-pedantic", "-pedantic-errors", "-pipe", "-pthread",
+    "-nostdinc", "-nostdinc++", "-Qunused-arguments"
+};
+
+/* any value */
+static constexpr const char* WORKERPREFIXES[] = {
+    "-O", "-g", "-m", "-std=", "--target="
+};
+
+/* -f<name>=<value>, values which are not files */
+static constexpr const char* WORKERVALUEFLAGS[] = {
+    "-fvisibility=", "-fmessage-length=", "-fdiagnostics-color=", "-fdiagnostics-format=",
+    "-fms-compatibility-version=", "-fmsc-version=", "-ffp-model=", "-ffp-contract=",
+    "-fdebug-prefix-map=", "-fmacro-prefix-map=", "-ffile-prefix-map=",
+    "-fconstexpr-depth=", "-fconstexpr-steps=", "-ftemplate-depth=",
+    "-fsanitize=", "-fno-sanitize=", "-fsanitize-recover=", "-fno-sanitize-recover=",
+    "-fsanitize-trap=", "-fno-sanitize-trap=", "-fstack-protector=",
+    "-fcf-protection=", "-ftrivial-auto-var-init=", "-finput-charset=",
+    "-fexec-charset=", "-fpack-struct=", "-fmax-type-align=", "-flto=",
+    "-ftls-model=", "-fdenormal-fp-math="
+};
+
+/* -f<name> switches which still read or write files, or run tools */
+static constexpr const char* WORKERDENIEDFLAGS[] = {
+    "plugin", "integrated-as", "profile-use", "profile-sample-use", "modules",
+    "crash-diagnostics", "save-optimization-record"
+};
+
+template<size_t N>
+static bool matchesflag(const char *arg, const char* const (&flags)[N], bool prefix)
+{
+    for (const char *flag : flags)
+    {
+        if (prefix ? !std::strncmp(arg, flag, std::strlen(flag)) : !std::strcmp(arg, flag))
+            return true;
+    }
+
+    return false;
+}
+
+static bool checkworkerargs(const string_vector &args)
+{
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const char *a = args[i].c_str();
+
+        if (!std::strcmp(a, "-mllvm"))
+            return false;
+
+        if (matchesflag(a, WORKERFLAGS, false) || matchesflag(a, WORKERPREFIXES, true))
+            continue;
+
+        if (!std::strcmp(a, "-target") && i+1 < args.size())
+        {
+            ++i;
+            continue;
+        }
+
+        /* -Xclang -fdebug-compilation-dir -Xclang <dir>, added by the client */
+        if (!std::strcmp(a, "-Xclang") && i+3 < args.size() &&
+            args[i+1] == "-fdebug-compilation-dir" && args[i+2] == "-Xclang")
+        {
+            i += 3;
+            continue;
+        }
+
+        /* -W<warning>, not -Wa,<arg> -Wl,<arg> -Wp,<arg> */
+        if (!std::strncmp(a, "-W", STRLEN("-W")) && (!a[2] || a[3] != ','))
+            continue;
+
+        if (!std::strncmp(a, "-f", STRLEN("-f")))
+        {
+            for (const char *denied : WORKERDENIEDFLAGS)
+                if (std::strstr(a, denied)) return false;
+
+            if (!std::strchr(a, '=') || matchesflag(a, WORKERVALUEFLAGS, true))
+                continue;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Splits the compile step into the local preprocessor
+ * command and the arguments for the worker
+ */
+
+static bool analyzedistribute(const std::string &compiler, char **cargs,
+                              distributeinfo &di)
+{
+    bool compile = false;
+    int sources = 0;
+
+    di.ppargs.push_back(compiler);
+
+    for (char **arg = cargs+1; *arg; ++arg)
+    {
+        const char *a = *arg;
+        const char *value;
+
+        if (*a == '@')
+            return false;
+
+        if (*a != '-')
+        {
+            di.source = a;
+            ++sources;
+            di.ppargs.push_back(a);
+            continue;
+        }
+
+        const optioninfo *opt = findoption(a, &value);
+
+        if (!opt)
+        {
+            di.ppargs.push_back(a);
+            di.ccargs.push_back(a);
+            continue;
+        }
+
+        /* the same invocations the object cache refuses */
+        if (opt->flags & OPT_NOCACHE)
+            return false;
+
+        /*
+         * Preprocessing with a PCH (-wc-auto-pch) leaves out
+         * the declarations the PCH holds
+         */
+
+        if (!std::strcmp(opt->name, "-include-pch"))
+            return false;
+
+        if ((opt->flags & OPT_SEPARATE) && !*value)
+        {
+            if (!arg[1])
+                return false;
+
+            value = *++arg;
+        }
+
+        switch (opt->id)
+        {
+            case optionid::compile:
+                compile = true;
+                continue;
+            case optionid::output:
+                di.output = value;
+                continue;
+            case optionid::deps:
+                di.deps = true;
+                break;
+            case optionid::depfile:
+                di.depfile = value;
+                break;
+            case optionid::deptarget:
+                di.deptarget = true;
+                break;
+            case optionid::language:
+                di.language = value;
+                break;
+            case optionid::debug:
+                if (std::strcmp(value, "0")) di.debug = true;
+                break;
+            default:
+                break;
+        }
+
+        di.ppargs.push_back(a);
+
+        if (value != a + std::strlen(opt->name))
+            di.ppargs.push_back(value);
+
+        if (opt->flags & (OPT_NOKEY|OPT_PPONLY) || opt->id == optionid::language)
+            continue;
+
+        di.ccargs.push_back(a);
+
+        if (value != a + std::strlen(opt->name))
+            di.ccargs.push_back(value);
+    }
+
+    if (!compile || sources != 1 || !(di.extension = getpreprocessedextension(di)))
+        return false;
+
+    if (di.output.empty())
+    {
+        std::string name = getfileName(di.source.c_str());
+        di.output = name.substr(0, name.find_last_of('.')) + ".o";
+    }
+
+    /*
+     * The dependency file is written by the local preprocessor,
+     * which does not know the object file name
+     */
+
+    if (di.deps)
+    {
+        if (di.depfile.empty())
+        {
+            size_t pos = di.output.find_last_of('.');
+
+            if (pos == std::string::npos || di.output.find(PATHDIV, pos) != std::string::npos)
+                pos = di.output.size();
+
+            di.depfile = di.output.substr(0, pos) + ".d";
+            di.ppargs.push_back("-MF");
+            di.ppargs.push_back(di.depfile);
+        }
+
+        if (!di.deptarget)
+        {
+            di.ppargs.push_back("-MQ");
+            di.ppargs.push_back(di.output);
+        }
+    }
+
+    if (!checkworkerargs(di.ccargs))
+        return false;
+
+    di.ppargs.push_back("-E");
+    di.ccargs.push_back("-c");
+
+    if (di.debug)
+    {
+        /* keep DW_AT_comp_dir pointing to the local directory */
+        char cwd[PATH_MAX];
+
+        if (!getcwd(cwd, sizeof(cwd)))
+            return false;
+
+        di.ccargs.push_back("-Xclang");
+        di.ccargs.push_back("-fdebug-compilation-dir");
+        di.ccargs.push_back("-Xclang");
+        di.ccargs.push_back(cwd);
+    }
+
+    return true;
+}
+
+static void splitlist(const char *p, string_vector &items)
+{
+    std::string item;
+
+    for (;; ++p)
+    {
+        if (!*p || *p == ',' || *p == ' ' || *p == '\t')
+        {
+            if (!item.empty())
+                items.push_back(item);
+
+            item.clear();
+
+            if (!*p)
+                break;
+
+            continue;
+        }
+
+        item += *p;
+    }
+}
+
+static void getworkers(const std::string &list, string_vector &workers)
+{
+    std::string worker;
+
+    if (list.empty())
+    {
+        if (getworkersocket(worker))
+            workers.push_back(worker);
+
+        return;
+    }
+
+    splitlist(list.c_str(), workers);
+}
+
+static char **tocargs(string_vector &strs, std::vector<char*> &cargs)
+{
+    for (auto &str : strs)
+        cargs.push_back(&str[0]);
+
+    cargs.push_back(nullptr);
+    return cargs.data();
+}
+
+int rundistributedcompile(const std::string &compiler, char **cargs,
+                          const buildsettings &settings, std::string &err)
+{
+    distributeinfo di;
+    string_vector workers;
+    std::vector<char*> args;
+    std::string request;
+    std::string ppout;
+    const std::string &version = settings.distributeclang;
+    int ret;
+
+    if (version.empty())
+        return DISTRIBUTE_LOCAL; /* unknown clang version */
+
+    if (!analyzedistribute(compiler, cargs, di))
+        return DISTRIBUTE_LOCAL;
+
+    getworkers(settings.workers, workers);
+
+    if (workers.empty())
+        return DISTRIBUTE_LOCAL;
+
+    {
+        tracespan span("preprocessor");
+
+        if ((ret = runprocess(tocargs(di.ppargs, args), &ppout, &err)) != 0)
+            return ret == RUNCOMMAND_ERROR ? DISTRIBUTE_LOCAL : ret;
+    }
+
+    args.clear();
+
+    putstring(request, PROTOCOLVERSION, STRLEN(PROTOCOLVERSION));
+    putstring(request, version.c_str(), version.size());
+    putstring(request, di.extension, std::strlen(di.extension));
+    putstrings(request, tocargs(di.ccargs, args));
+    putstring(request, ppout.c_str(), ppout.size());
+
+    /*
+     * Spread the invocations over the workers, try
+     * the others if one is down or runs another clang
+     */
+
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    size_t first = getpid() % workers.size();
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        const std::string &worker = workers[(first + i) % workers.size()];
+        tracespan span("remote compile", worker);
+        std::string reply;
+        std::string object;
+        std::string workererr;
+        uint32_t status;
+        size_t pos = 1;
+        int fd;
+
+        if ((fd = connectworker(worker)) == -1)
+            continue;
+
+        struct timeval tv = { COMPILETIMEOUT, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        bool ok = sendmessage(fd, request) && recvmessage(fd, reply);
+        close(fd);
+
+        /* the other workers would refuse the arguments as well */
+        if (ok && !reply.empty() && reply[0] == MSG_REJECT)
+            break;
+
+        if (!ok || reply.empty() || reply[0] != MSG_OBJECT ||
+            !getint(reply, pos, status) || !getstring(reply, pos, workererr) ||
+            !getstring(reply, pos, object))
+        {
+            continue; /* down, busy or a different clang */
+        }
+
+        if (!status && !writefileatomic(di.output, object))
+        {
+            err += "cannot write " + di.output + "\n";
+            status = EXIT_FAILURE;
+        }
+
+        signal(SIGPIPE, sigpipe);
+        err += workererr;
+        return status;
+    }
+
+    signal(SIGPIPE, sigpipe);
+
+    /* the local compile repeats the preprocessor's warnings */
+    err.clear();
+    return DISTRIBUTE_LOCAL;
+}
+
+/*
+ * Worker
+ */
+
+static bool getclangversion(const char *clang, compilerver &version)
+{
+    static constexpr char VERSIONPREFIX[] = "clang version ";
+    char *args[] = { const_cast<char*>(clang), const_cast<char*>("--version"), nullptr };
+    std::string out;
+    size_t pos;
+
+    if (runprocess(args, &out) != 0 ||
+        (pos = out.find(VERSIONPREFIX)) == std::string::npos)
+    {
+        return false;
+    }
+
+    version = parsecompilerversion(out.c_str() + pos + STRLEN(VERSIONPREFIX));
+    return version != compilerver();
+}
+
+static void handlecompile(int conn, const char *clang, const compilerver &version)
+{
+    std::string msg;
+    std::string protocol;
+    std::string clientversion;
+    std::string extension;
+    std::string source;
+    std::string object;
+    std::string err;
+    string_vector args;
+    std::vector<char*> cargs;
+    size_t pos = 0;
+    int ret;
+
+    if (!recvmessage(conn, msg) || !getstring(msg, pos, protocol) ||
+        protocol != PROTOCOLVERSION || !getstring(msg, pos, clientversion) ||
+        !getstring(msg, pos, extension) || !getstrings(msg, pos, args) ||
+        !getstring(msg, pos, source))
+    {
+        return;
+    }
+
+    if (parsecompilerversion(clientversion.c_str()) != version)
+    {
+        msg = MSG_MISMATCH;
+        putstring(msg, version.str().c_str(), version.str().size());
+        sendmessage(conn, msg);
+        return;
+    }
+
+    if ((extension != ".i" && extension != ".ii") || !checkworkerargs(args))
+    {
+        msg = MSG_REJECT;
+        sendmessage(conn, msg);
+        return;
+    }
+
+    std::string dir = (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    dir += "/wclang-worker.XXXXXX";
+
+    if (!mkdtemp(&dir[0]))
+        return;
+
+    std::string input = dir + "/input" + extension;
+    std::string output = dir + "/output.o";
+
+    cargs.push_back(const_cast<char*>(clang));
+
+    for (auto &arg : args)
+        cargs.push_back(&arg[0]);
+
+    cargs.push_back(&input[0]);
+    cargs.push_back(const_cast<char*>("-o"));
+    cargs.push_back(&output[0]);
+    cargs.push_back(nullptr);
+
+    if (!writefileatomic(input, source))
+        ret = EXIT_FAILURE;
+    else if ((ret = runprocess(cargs.data(), nullptr, &err)) == RUNCOMMAND_ERROR)
+        ret = EXIT_FAILURE;
+    else if (!ret && !readfile(output.c_str(), object))
+        ret = EXIT_FAILURE;
+
+    unlink(input.c_str());
+    unlink(output.c_str());
+    rmdir(dir.c_str());
+
+    msg = MSG_OBJECT;
+    putint(msg, ret);
+    putstring(msg, err.c_str(), err.size());
+    putstring(msg, object.c_str(), object.size());
+    sendmessage(conn, msg);
+}
+
+/*
+ * Hosts allowed to connect to a TCP worker (WCLANG_WORKER_ALLOW):
+ * addresses or networks (address/bits), loopback is always allowed
+ */
+
+struct allownet
+{
+    int family;
+    unsigned char addr[16];
+    int bits;
+};
+
+static bool getallowed(const char *list, std::vector<allownet> &nets)
+{
+    string_vector items;
+
+    splitlist(list, items);
+
+    for (auto &item : items)
+    {
+        std::string::size_type slash = item.find('/');
+        std::string addr = item.substr(0, slash);
+        allownet net;
+        char *end;
+
+        std::memset(&net, 0, sizeof(net));
+
+        if (inet_pton(AF_INET, addr.c_str(), net.addr) == 1)
+        {
+            net.family = AF_INET;
+            net.bits = 32;
+        }
+        else if (inet_pton(AF_INET6, addr.c_str(), net.addr) == 1)
+        {
+            net.family = AF_INET6;
+            net.bits = 128;
+        }
+        else
+        {
+            std::cerr << "wclang-worker: invalid address '" << item
+                      << "' in WCLANG_WORKER_ALLOW" << std::endl;
+            return false;
+        }
+
+        if (slash != std::string::npos)
+        {
+            long bits = std::strtol(item.c_str()+slash+1, &end, 10);
+
+            if (end == item.c_str()+slash+1 || *end || bits < 0 || bits > net.bits)
+            {
+                std::cerr << "wclang-worker: invalid network '" << item
+                          << "' in WCLANG_WORKER_ALLOW" << std::endl;
+                return false;
+            }
+
+            net.bits = bits;
+        }
+
+        nets.push_back(net);
+    }
+
+    return true;
+}
+
+static bool matchesnet(const unsigned char *addr, const allownet &net)
+{
+    int bytes = net.bits / 8;
+    int rest = net.bits % 8;
+
+    if (std::memcmp(addr, net.addr, bytes))
+        return false;
+
+    if (!rest)
+        return true;
+
+    unsigned char mask = 0xff << (8 - rest);
+    return (addr[bytes] & mask) == (net.addr[bytes] & mask);
+}
+
+static bool allowpeer(const struct sockaddr_storage &peer,
+                      const std::vector<allownet> &nets)
+{
+    const unsigned char *addr;
+    int family = peer.ss_family;
+
+    switch (family)
+    {
+        case AF_UNIX:
+            return true;
+        case AF_INET:
+            addr = reinterpret_cast<const unsigned char*>(
+                     &reinterpret_cast<const struct sockaddr_in*>(&peer)->sin_addr);
+            break;
+        case AF_INET6:
+        {
+            const struct in6_addr *in6 =
+              &reinterpret_cast<const struct sockaddr_in6*>(&peer)->sin6_addr;
+
+            if (IN6_IS_ADDR_LOOPBACK(in6))
+                return true;
+
+            addr = reinterpret_cast<const unsigned char*>(in6);
+
+            if (IN6_IS_ADDR_V4MAPPED(in6))
+            {
+                family = AF_INET;
+                addr += 12;
+            }
+
+            break;
+        }
+        default:
+            return false;
+    }
+
+    if (family == AF_INET && addr[0] == 127)
+        return true;
+
+    for (auto &net : nets)
+        if (net.family == family && matchesnet(addr, net))
+            return true;
+
+    return false;
+}
+
+static int listenworker(const std::string &address)
+{
+    int fd = -1;
+
+    if (isunixsocket(address))
+    {
+        struct sockaddr_un addr;
+
+        if (!getsocketaddress(address, addr))
+            return -1;
+
+        if ((fd = connectsocket(address)) != -1)
+        {
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
+        }
+
+        mkdirs(address.substr(0, address.find_last_of(PATHDIV)));
+        unlink(address.c_str()); /* stale socket */
+
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+            return -1;
+
+        mode_t mask = umask(077);
+
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+            listen(fd, SOMAXCONN))
+        {
+            umask(mask);
+            close(fd);
+            return -1;
+        }
+
+        umask(mask);
+        return fd;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *res;
+    std::string host;
+    std::string port;
+    int one = 1;
+
+    splitaddress(address, host, port);
+
+    /* without a host (:<port>) only loopback is bound */
+
+    if (host.empty())
+        host = "127.0.0.1";
+
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res))
+        return -1;
+
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next)
+    {
+        if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1)
+            continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, SOMAXCONN))
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+int runworker(int argc, char **argv)
+{
+    std::string address;
+    std::vector<allownet> allowed;
+    compilerver version;
+    struct sigaction sa;
+    const char *clang;
+    const char *p;
+    long jobs;
+    long running = 0;
+    int fd;
+
+    if (argc > 2 || (argc == 2 && !std::strcmp(argv[1], "--help")))
+    {
+        std::cerr << "usage: wclang-worker [<unix socket> | <host>:<port> | :<port>]"
+                  << std::endl;
+        return 1;
+    }
+
+    if (argc == 2) address = argv[1];
+    else if (!getworkersocket(address))
+    {
+        std::cerr << "wclang-worker: cannot determine socket path" << std::endl;
+        return 1;
+    }
+
+    if (!(clang = getenv("WCLANG_WORKER_CLANG")) || !*clang)
+        clang = "clang";
+
+    if (!getclangversion(clang, version))
+    {
+        std::cerr << "wclang-worker: cannot determine the version of '"
+                  << clang << "' (set WCLANG_WORKER_CLANG)" << std::endl;
+        return 1;
+    }
+
+    if (!(p = getenv("WCLANG_WORKER_JOBS")) || (jobs = std::atol(p)) < 1)
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ((p = getenv("WCLANG_WORKER_ALLOW")) && !getallowed(p, allowed))
+        return 1;
+
+    if ((fd = listenworker(address)) == -1)
+    {
+        std::cerr << "wclang-worker: cannot listen on " << address << ": "
+                  << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = [](int) { stopworker = 1; };
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "wclang-worker: clang " << version.str() << ", " << jobs
+              << " jobs, listening on " << address << std::endl;
+
+    while (!stopworker)
+    {
+        int status;
+        pid_t pid;
+
+        while (waitpid(-1, &status, WNOHANG) > 0)
+            --running;
+
+        /* the backlog queues the others */
+        if (running >= jobs)
+        {
+            if (waitpid(-1, &status, 0) > 0)
+                --running;
+
+            continue; /* interrupted by SIGTERM */
+        }
+
+        struct sockaddr_storage peer;
+        socklen_t peerlen = sizeof(peer);
+        int conn = accept(fd, reinterpret_cast<struct sockaddr*>(&peer), &peerlen);
+
+        if (conn == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            std::cerr << "wclang-worker: accept() failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if (!allowpeer(peer, allowed))
+        {
+            close(conn);
+            continue;
+        }
+
+        struct timeval tv = { 30, 0 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        if (!(pid = fork()))
+        {
+            close(fd);
+            signal(SIGTERM, SIG_DFL);
+            signal(SIGINT, SIG_DFL);
+            handlecompile(conn, clang, version);
+            _exit(EXIT_SUCCESS);
+        }
+
+        if (pid != -1)
+            ++running;
+
+        close(conn);
+    }
+
+    close(fd);
+
+    if (isunixsocket(address))
+        unlink(address.c_str());
+
+    return 0;
+}
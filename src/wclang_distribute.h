@@ -0,0 +1,16 @@
+/*
+ * Distributed compilation (-wc-distribute)
+ *
+ * Compile steps are preprocessed locally with the include
+ * paths wclang resolved, the preprocessed source is compiled
+ * by a wclang-worker (TCP or Unix socket) running a clang of
+ * the same version. The compile runs locally if no worker
+ * can take it.
+ */
+
+constexpr int DISTRIBUTE_LOCAL = -1;
+constexpr int WORKER_PORT = 3635;
+
+int rundistributedcompile(const std::string &compiler, char **cargs,
+                          const buildsettings &settings, std::string &err);
+int runworker(int argc, char **argv);
@@ -0,0 +1,932 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "wclang.h"
+#include "wclang_jobs.h"
+#include "wclang_options.h"
+#include "wclang_rsp.h"
+
+static constexpr const char* SOURCEEXTENSIONS[] = {
+    ".c", ".cc", ".cpp", ".cxx", ".c++", ".C"
+};
+
+static bool issourcefile(const char *file)
+{
+    const char *ext = std::strrchr(file, '.');
+
+    if (!ext)
+        return false;
+
+    for (const char *e : SOURCEEXTENSIONS)
+        if (!std::strcmp(ext, e)) return true;
+
+    return false;
+}
+
+struct compilejob {
+    const char *source;
+    const char *dir;
+    int line;
+    std::string object;
+    std::vector<char*> args;
+    std::string out;
+    std::string err;
+    int outfd;
+    int errfd;
+    pid_t pid;
+    int status;
+
+    compilejob() : source(), dir(), line(), outfd(-1), errfd(-1), pid(-1), status(0) {}
+};
+
+/*
+ * Interrupting wclang interrupts the jobs too,
+ * they are not in the foreground process group
+ */
+
+static constexpr int FORWARDSIGNALS[] = { SIGINT, SIGTERM, SIGHUP };
+static constexpr size_t NFORWARDSIGNALS = sizeof(FORWARDSIGNALS) / sizeof(FORWARDSIGNALS[0]);
+
+static struct sigaction oldactions[NFORWARDSIGNALS];
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupthandler(int sig)
+{
+    interrupted = sig;
+}
+
+static void forwardsignals(bool enable)
+{
+    struct sigaction sa;
+
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = interrupthandler;
+    sigemptyset(&sa.sa_mask);
+
+    for (size_t i = 0; i < NFORWARDSIGNALS; ++i)
+    {
+        if (enable)
+            sigaction(FORWARDSIGNALS[i], &sa, &oldactions[i]);
+        else
+            sigaction(FORWARDSIGNALS[i], &oldactions[i], nullptr);
+    }
+}
+
+static bool startjob(compilejob &job, const std::string &compiler,
+                     runcompilerfun runcompiler)
+{
+    int outpipe[2];
+    int errpipe[2];
+
+    if (pipe(outpipe))
+        return false;
+
+    if (pipe(errpipe))
+    {
+        close(outpipe[0]);
+        close(outpipe[1]);
+        return false;
+    }
+
+    if ((job.pid = fork()) == -1)
+    {
+        for (int fd : { outpipe[0], outpipe[1], errpipe[0], errpipe[1] })
+            close(fd);
+
+        return false;
+    }
+
+    /*
+     * Every job gets its own process group, so cancelling
+     * it also reaches the compiler the object cache runs
+     */
+
+    setpgid(job.pid ? job.pid : 0, 0);
+
+    if (!job.pid)
+    {
+        dup2(outpipe[1], STDOUT_FILENO);
+        dup2(errpipe[1], STDERR_FILENO);
+
+        for (int fd : { outpipe[0], outpipe[1], errpipe[0], errpipe[1] })
+            close(fd);
+
+        forwardsignals(false);
+
+        if (job.dir && chdir(job.dir))
+        {
+            std::cerr << "cannot change directory to " << job.dir << ": "
+                      << strerror(errno) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        /* goes through -wc-cache and -wc-auto-pch as well */
+        std::exit(runcompiler(compiler, job.args.data()));
+    }
+
+    close(outpipe[1]);
+    close(errpipe[1]);
+
+    job.outfd = outpipe[0];
+    job.errfd = errpipe[0];
+    return true;
+}
+
+static void finishjob(compilejob &job)
+{
+    int status;
+
+    while (waitpid(job.pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            job.status = EXIT_FAILURE;
+            job.pid = -1;
+            return;
+        }
+    }
+
+    job.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    job.pid = -1;
+}
+
+static void writeall(int fd, const std::string &data)
+{
+    size_t pos = 0;
+
+    while (pos < data.size())
+    {
+        ssize_t n = write(fd, data.c_str()+pos, data.size()-pos);
+
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        pos += n;
+    }
+}
+
+static void canceljobs(std::vector<compilejob*> &running, int sig)
+{
+    /* their output is discarded */
+
+    for (auto *job : running)
+    {
+        kill(-job->pid, sig);
+
+        for (int fd : { job->outfd, job->errfd })
+            if (fd != -1) close(fd);
+
+        finishjob(*job);
+    }
+
+    running.clear();
+}
+
+/*
+ * Runs the compile jobs, at most 'jobs' at once.
+ * The output of every job is buffered and written
+ * at once, when the job has finished.
+ */
+
+static int runjobs(std::vector<compilejob> &queue, const std::string &compiler, int jobs,
+                   bool failfast, runcompilerfun runcompiler)
+{
+    std::vector<compilejob*> running;
+    size_t next = 0;
+    int ret = 0;
+
+    forwardsignals(true);
+
+    while (next < queue.size() || !running.empty())
+    {
+        if (interrupted)
+        {
+            int sig = interrupted;
+
+            canceljobs(running, sig);
+            forwardsignals(false);
+            raise(sig);
+            return 128 + sig;
+        }
+
+        while ((!ret || !failfast) && next < queue.size() && (int)running.size() < jobs)
+        {
+            compilejob &job = queue[next++];
+
+            if (!startjob(job, compiler, runcompiler))
+            {
+                std::cerr << "cannot start compile job for " << job.source << ": "
+                          << strerror(errno) << std::endl;
+                ret = EXIT_FAILURE;
+                break;
+            }
+
+            running.push_back(&job);
+        }
+
+        if (running.empty())
+            break;
+
+        std::vector<struct pollfd> fds;
+
+        for (auto *job : running)
+        {
+            for (int fd : { job->outfd, job->errfd })
+            {
+                if (fd == -1) continue;
+
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                fds.push_back(pfd);
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), -1) == -1)
+        {
+            if (errno == EINTR) continue;
+
+            canceljobs(running, SIGTERM);
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        for (const auto &pfd : fds)
+        {
+            if (!pfd.revents)
+                continue;
+
+            for (auto *job : running)
+            {
+                bool isout = pfd.fd == job->outfd;
+
+                if (!isout && pfd.fd != job->errfd)
+                    continue;
+
+                char buf[65536];
+                ssize_t n = read(pfd.fd, buf, sizeof(buf));
+
+                if (n > 0)
+                    (isout ? job->out : job->err).append(buf, n);
+                else if (n == 0 || errno != EINTR)
+                {
+                    close(pfd.fd);
+                    (isout ? job->outfd : job->errfd) = -1;
+                }
+
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < running.size();)
+        {
+            compilejob &job = *running[i];
+
+            if (job.outfd != -1 || job.errfd != -1)
+            {
+                ++i;
+                continue;
+            }
+
+            finishjob(job);
+            writeall(STDOUT_FILENO, job.out);
+            writeall(STDERR_FILENO, job.err);
+
+            if (job.line)
+            {
+                /* -wc-batch */
+                writeall(STDOUT_FILENO, "job " + std::to_string(job.line) + " (" +
+                         job.source + "): exit status " + std::to_string(job.status) + "\n");
+            }
+
+            if (job.status && !ret)
+                ret = job.status;
+
+            running.erase(running.begin()+i);
+        }
+
+        if (ret && failfast && !running.empty())
+            canceljobs(running, SIGTERM); /* cancel the remaining jobs */
+    }
+
+    forwardsignals(false);
+
+    return ret;
+}
+
+/*
+ * The final link goes through runcompiler() as well (resource
+ * scripts, lld threads), in a child as it may exec the linker
+ */
+
+static int runlink(const std::string &compiler, char **args, runcompilerfun runcompiler)
+{
+    pid_t pid;
+    int status;
+
+    if ((pid = fork()) == -1)
+    {
+        std::cerr << "cannot start link: " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!pid)
+        std::exit(runcompiler(compiler, args));
+
+    while (waitpid(pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+            return EXIT_FAILURE;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int runparallelbuild(const std::string &compiler, char **cargs, int jobs,
+                     bool failfast, runcompilerfun runcompiler)
+{
+    std::vector<compilejob> queue;
+    std::vector<char*> linkargs;
+    std::vector<char*> compileargs;
+    char tmpdir[PATH_MAX];
+    const char *p;
+    int ret;
+
+    /* mingw gcc is used for linking only */
+
+    if (!std::strstr(getfileName(compiler.c_str()), "clang"))
+        return JOBS_NOT_APPLICABLE;
+
+    /*
+     * Find the source files, everything else
+     * except linker options is passed to the compile jobs
+     */
+
+    compileargs.push_back(cargs[0]);
+
+    for (char **arg = cargs+1; *arg; ++arg)
+    {
+        const char *a = *arg;
+        const char *value;
+        const optioninfo *opt = *a == '-' ? findoption(a, &value) : nullptr;
+
+        /*
+         * Response files and options which make the invocation
+         * something else than a plain compile and link
+         */
+
+        if (*a == '@' || (opt && (opt->flags & OPT_NOLINK)))
+            return JOBS_NOT_APPLICABLE;
+
+        if (*a != '-')
+        {
+            if (issourcefile(a))
+            {
+                compilejob job;
+                job.source = a;
+                queue.push_back(job);
+            }
+
+            continue;
+        }
+
+        bool separate = opt && (opt->flags & OPT_SEPARATE) && !*value;
+
+        /*
+         * Output and link-only options are not passed to the compile jobs
+         */
+
+        if (opt && (opt->id == optionid::output || (opt->flags & OPT_LINKONLY)))
+        {
+            if (separate && !*++arg) return JOBS_NOT_APPLICABLE;
+            continue;
+        }
+
+        compileargs.push_back(*arg);
+
+        if (separate)
+        {
+            if (!*++arg) return JOBS_NOT_APPLICABLE;
+            compileargs.push_back(*arg);
+        }
+    }
+
+    if (queue.size() < 2)
+        return JOBS_NOT_APPLICABLE;
+
+    if (!(p = getenv("TMPDIR")) || !*p)
+        p = "/tmp";
+
+    if (std::snprintf(tmpdir, sizeof(tmpdir), "%s/wclang.XXXXXX", p) >= (int)sizeof(tmpdir) ||
+        !mkdtemp(tmpdir))
+    {
+        std::cerr << "cannot create temporary directory: " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * <compiler> <flags> -Qunused-arguments -c <source> -o <tmpdir>/<n>-<source>.o
+     */
+
+    size_t n = 0;
+
+    for (auto &job : queue)
+    {
+        std::string name = getfileName(job.source);
+
+        job.object = std::string(tmpdir) + "/" + std::to_string(n++) + "-" +
+                     name.substr(0, name.find_last_of('.')) + ".o";
+
+        job.args = compileargs;
+        job.args.push_back(const_cast<char*>("-Qunused-arguments"));
+        job.args.push_back(const_cast<char*>("-c"));
+        job.args.push_back(const_cast<char*>(job.source));
+        job.args.push_back(const_cast<char*>("-o"));
+        job.args.push_back(&job.object[0]);
+        job.args.push_back(nullptr);
+    }
+
+    ret = runjobs(queue, compiler, jobs, failfast, runcompiler);
+
+    if (!ret)
+    {
+        /*
+         * Link with the sources replaced by the objects,
+         * in their original order
+         */
+
+        n = 0;
+        linkargs.push_back(cargs[0]);
+        linkargs.push_back(const_cast<char*>("-Qunused-arguments"));
+
+        for (char **arg = cargs+1; *arg; ++arg)
+        {
+            if (n < queue.size() && *arg == queue[n].source)
+                linkargs.push_back(&queue[n++].object[0]);
+            else
+                linkargs.push_back(*arg);
+        }
+
+        linkargs.push_back(nullptr);
+
+        ret = runlink(compiler, linkargs.data(), runcompiler);
+    }
+
+    for (const auto &job : queue)
+        unlink(job.object.c_str());
+
+    rmdir(tmpdir);
+    return ret;
+}
+
+/*
+ * Batch mode
+ */
+
+static bool readbatchfile(const char *file, std::string &content)
+{
+    char buf[65536];
+    ssize_t n;
+    int fd;
+
+    if (!std::strcmp(file, "-"))
+        fd = STDIN_FILENO;
+    else if ((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1)
+        return false;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n == -1 && errno == EINTR))
+        if (n > 0) content.append(buf, n);
+
+    if (fd != STDIN_FILENO)
+        close(fd);
+
+    return !n;
+}
+
+int runbatch(const char *file, char *wrapper, int jobs, bool failfast,
+             runcompilerfun runjob)
+{
+    std::vector<compilejob> queue;
+    std::string content;
+    char *p, *end;
+    int line = 0;
+    int ret;
+
+    if (!readbatchfile(file, content))
+    {
+        std::cerr << "cannot read " << file << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * One job per line: <directory> <argument>...
+     * The arguments point into 'content'
+     */
+
+    content += '\n';
+    p = &content[0];
+    end = p + content.size();
+
+    while (p < end)
+    {
+        char *eol = static_cast<char*>(std::memchr(p, '\n', end-p));
+        std::vector<char*> args;
+        compilejob job;
+
+        ++line;
+        *eol = '\0';
+
+        if (*p != '#')
+            splitarguments(p, eol, args);
+
+        p = eol+1;
+
+        if (args.empty())
+            continue;
+
+        if (args.size() < 2)
+        {
+            std::cerr << file << ":" << line << ": no compiler arguments" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        job.dir = args[0];
+        job.line = line;
+
+        job.args.push_back(wrapper);
+
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (!job.source && issourcefile(args[i]))
+                job.source = args[i];
+
+            job.args.push_back(args[i]);
+        }
+
+        if (!job.source)
+            job.source = args[1];
+
+        job.args.push_back(nullptr);
+        queue.push_back(std::move(job));
+    }
+
+    ret = runjobs(queue, wrapper, jobs, failfast, runjob);
+
+    size_t failed = 0;
+
+    for (const auto &job : queue)
+        if (job.status) ++failed;
+
+    if (failed)
+        std::cerr << failed << " of " << queue.size() << " jobs failed" << std::endl;
+
+    return ret;
+}
+
+/*
+ * Multi-target fan-out
+ */
+
+static std::string suffixfilename(const char *file, const std::string &suffix)
+{
+    const char *ext = std::strrchr(getfileName(file), '.');
+
+    if (!ext || ext == getfileName(file))
+        return std::string(file) + "." + suffix;
+
+    return std::string(file, ext-file) + "." + suffix + ext;
+}
+
+static bool isobjectfile(const char *file)
+{
+    const char *ext = std::strrchr(file, '.');
+    return ext && *file != '-' && (!std::strcmp(ext, ".o") || !std::strcmp(ext, ".obj"));
+}
+
+int runmultitarget(int argc, char **argv, const char *targets, bool failfast,
+                   runcompilerfun runjob)
+{
+    static stringarena arena;
+    std::vector<compilejob> queue;
+    string_vector names;
+    const char *compilerflag = nullptr;
+    const char *source = nullptr;
+    const char *driver;
+    bool output = false;
+    bool nolink = false;
+    size_t sources = 0;
+
+    /* <target>-clang[++] */
+
+    if (!(driver = std::strrchr(getfileName(argv[0]), '-')))
+    {
+        std::cerr << "invalid invocation name: " << argv[0] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (const char *p = targets; *p;)
+    {
+        const char *end = std::strchr(p, ',');
+        std::string target(p, end ? end-p : std::strlen(p));
+
+        p += target.size();
+        if (*p == ',') ++p;
+
+        if (!target.empty() &&
+            std::find(names.begin(), names.end(), target) == names.end())
+        {
+            names.push_back(target);
+        }
+    }
+
+    if (names.empty())
+    {
+        std::cerr << "-wc-targets: no targets given" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *value;
+        const optioninfo *opt;
+
+        if (*argv[i] != '-')
+        {
+            if (issourcefile(argv[i]) && !sources++)
+                source = argv[i];
+
+            continue;
+        }
+
+        if (!(opt = findoption(argv[i], &value)))
+            continue;
+
+        if (opt->id == optionid::output)
+            output = true;
+        else if (opt->id == optionid::compile)
+            compilerflag = argv[i];
+
+        if (opt->flags & OPT_NOLINK)
+            nolink = true;
+
+        if ((opt->flags & OPT_SEPARATE) && !*value && i+1 < argc)
+            ++i;
+    }
+
+    /*
+     * The outputs of the targets must not overwrite each other,
+     * name them if the compiler would choose the name
+     */
+
+    if (!output && nolink && (!compilerflag || sources != 1))
+    {
+        std::cerr << "-wc-targets: cannot name the outputs of the targets, "
+                     "use -o <file>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    queue.resize(names.size());
+
+    for (size_t n = 0; n < names.size(); ++n)
+    {
+        compilejob &job = queue[n];
+        const std::string &target = names[n];
+        std::string name;
+
+        if (target == "win32") name = "w32";
+        else if (target == "win64") name = "w64";
+        else name = target;
+
+        name += driver;
+
+        job.source = arena.copy(target);
+        job.args.push_back(arena.copy(name));
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *value;
+            const optioninfo *opt = *argv[i] == '-' ? findoption(argv[i], &value) : nullptr;
+
+            if (opt && opt->id == optionid::wc_targets)
+                continue;
+
+            if (!opt && isobjectfile(argv[i]))
+            {
+                /*
+                 * Built by an earlier -wc-targets invocation, or
+                 * a prebuilt object used by all targets as it is
+                 */
+
+                std::string file = suffixfilename(argv[i], target);
+
+                if (access(file.c_str(), F_OK))
+                    job.args.push_back(argv[i]);
+                else
+                    job.args.push_back(arena.copy(file));
+
+                continue;
+            }
+
+            if (opt && (opt->id == optionid::output || opt->id == optionid::depfile ||
+                        opt->id == optionid::deptarget))
+            {
+                /* -o <file>, -o<file>, -MF <file>, -MT <target>, ... */
+
+                if (*value)
+                {
+                    std::string arg(argv[i], value-argv[i]);
+                    job.args.push_back(arena.copy(arg + suffixfilename(value, target)));
+                    continue;
+                }
+
+                job.args.push_back(argv[i]);
+
+                if (i+1 < argc)
+                    job.args.push_back(arena.copy(suffixfilename(argv[++i], target)));
+
+                continue;
+            }
+
+            job.args.push_back(argv[i]);
+        }
+
+        if (!output)
+        {
+            std::string file;
+
+            if (nolink)
+            {
+                file = getfileName(source);
+                file = file.substr(0, file.find_last_of('.'));
+                file += std::strcmp(compilerflag, "-S") ? ".o" : ".s";
+            }
+            else
+            {
+                file = "a.exe";
+            }
+
+            job.args.push_back(const_cast<char*>("-o"));
+            job.args.push_back(arena.copy(suffixfilename(file.c_str(), target)));
+        }
+
+        job.args.push_back(nullptr);
+    }
+
+    return runjobs(queue, argv[0], queue.size(), failfast, runjob);
+}
+
+/*
+ * Job slots borrowed from make
+ */
+
+static std::string jobslots;
+static int jobserverwrite = -1;
+static bool ownjobserverwrite = false;
+
+static int openjobserver()
+{
+    static constexpr const char* AUTHOPTIONS[] = {
+        "--jobserver-auth=", "--jobserver-fds="
+    };
+
+    const char *makeflags = getenv("MAKEFLAGS");
+    const char *auth = nullptr;
+    int rfd, wfd;
+
+    if (!makeflags)
+        return -1;
+
+    for (const char *opt : AUTHOPTIONS)
+    {
+        /* the last one counts */
+        for (const char *p = makeflags; (p = std::strstr(p, opt)); p += std::strlen(opt))
+            auth = p + std::strlen(opt);
+    }
+
+    if (!auth)
+        return -1;
+
+    if (!std::strncmp(auth, "fifo:", STRLEN("fifo:")))
+    {
+        std::string fifo(auth + STRLEN("fifo:"));
+        fifo.resize(fifo.find(' ') == std::string::npos ? fifo.size() : fifo.find(' '));
+
+        if ((rfd = open(fifo.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1)
+            return -1;
+
+        jobserverwrite = rfd;
+        ownjobserverwrite = true;
+        return rfd;
+    }
+
+    if (std::sscanf(auth, "%d,%d", &rfd, &wfd) != 2 || rfd < 0 || wfd < 0 ||
+        fcntl(rfd, F_GETFD) == -1 || fcntl(wfd, F_GETFD) == -1)
+    {
+        return -1; /* make did not pass the pipe to us (no '+' rule) */
+    }
+
+    /*
+     * A private non-blocking reader, O_NONBLOCK on the
+     * inherited descriptor would affect make as well
+     */
+
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/self/fd/%d", rfd);
+
+    if ((rfd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1)
+        return -1;
+
+    jobserverwrite = wfd;
+    return rfd;
+}
+
+int acquirejobslots(int max)
+{
+    char buf[256];
+    ssize_t n;
+    int fd;
+
+    if ((fd = openjobserver()) == -1)
+        return -1;
+
+    if (max > static_cast<int>(sizeof(buf)))
+        max = sizeof(buf);
+
+    while (max > 0 && (n = read(fd, buf, max)) != 0)
+    {
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            break; /* EAGAIN: no free slot */
+        }
+
+        jobslots.append(buf, n);
+        max -= n;
+    }
+
+    if (fd != jobserverwrite)
+        close(fd);
+
+    return jobslots.size();
+}
+
+void releasejobslots()
+{
+    const char *p = jobslots.c_str();
+    size_t len = jobslots.size();
+
+    while (len)
+    {
+        ssize_t n = write(jobserverwrite, p, len);
+
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    if (ownjobserverwrite)
+        close(jobserverwrite);
+
+    jobslots.clear();
+    jobserverwrite = -1;
+    ownjobserverwrite = false;
+}
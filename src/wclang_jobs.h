@@ -0,0 +1,51 @@
+/*
+ * Parallel multi-source driver (-wc-jobs=N)
+ *
+ * Splits 'w32-clang a.c b.c -o app.exe' into one compile
+ * job per source file and a final link
+ */
+
+typedef int (*runcompilerfun)(const std::string &compiler, char **cargs);
+
+constexpr int JOBS_NOT_APPLICABLE = -1;
+
+int runparallelbuild(const std::string &compiler, char **cargs, int jobs,
+                     bool failfast, runcompilerfun runcompiler);
+
+/*
+ * Batch mode (-wc-batch=<file|->)
+ *
+ * Reads one job per line, the working directory followed
+ * by the compiler arguments (quoted like a response file),
+ * and runs runjob(wrapper, <wrapper> <arguments>) for each
+ * of them in a child process, at most 'jobs' at once.
+ * The output of a job is followed by a status line.
+ */
+
+int runbatch(const char *file, char *wrapper, int jobs, bool failfast,
+             runcompilerfun runjob);
+
+/*
+ * Multi-target fan-out (-wc-targets=win32,win64,<triple>,...)
+ *
+ * Runs runjob(<target>-clang, <arguments>) for every target
+ * at once, the target is inserted into the names of the
+ * output, dependency and input object files:
+ * foo.o -> foo.win64.o
+ */
+
+int runmultitarget(int argc, char **argv, const char *targets, bool failfast,
+                   runcompilerfun runjob);
+
+/*
+ * GNU make jobserver (MAKEFLAGS --jobserver-auth=R,W or
+ * --jobserver-auth=fifo:PATH)
+ *
+ * acquirejobslots() borrows up to 'max' free job slots
+ * for a multithreaded step and returns how many it got,
+ * or -1 without a jobserver. releasejobslots() gives
+ * them back.
+ */
+
+int acquirejobslots(int max);
+void releasejobslots();
@@ -0,0 +1,263 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <cstring>
+#include "wclang.h"
+#include "wclang_options.h"
+
+#define SEPARATE OPT_SEPARATE
+#define JOINED OPT_JOINED
+#define NOLINK OPT_NOLINK
+#define LINKONLY OPT_LINKONLY
+#define NOCACHE OPT_NOCACHE
+#define NOKEY OPT_NOKEY
+#define WCLANG OPT_WCLANG
+#define PPONLY OPT_PPONLY
+
+static constexpr optioninfo OPTIONS[] = {
+    /*
+     * Compile steps
+     */
+
+    { "-c", optionid::compile, NOLINK },
+    { "-S", optionid::compile, NOLINK|NOCACHE },
+    { "-E", optionid::none, NOLINK|NOCACHE },
+    { "-fsyntax-only", optionid::none, NOLINK|NOCACHE },
+    { "--analyze", optionid::none, NOLINK|NOCACHE },
+    { "-save-temps", optionid::none, NOLINK|NOCACHE },
+    { "-save-temps=", optionid::none, JOINED|NOLINK|NOCACHE },
+    { "-emit-llvm", optionid::none, NOLINK },
+    { "-", optionid::none, NOLINK|NOCACHE }, /* stdin */
+    { "-x", optionid::language, SEPARATE|JOINED|NOLINK },
+    { "-o", optionid::output, SEPARATE|JOINED|NOKEY },
+
+    /*
+     * Code generation
+     */
+
+    { "-O", optionid::optimize, JOINED },
+    { "-g", optionid::debug, JOINED },
+    { "-gsplit-dwarf", optionid::none, NOCACHE }, /* writes a .dwo next to the object */
+    { "-gsplit-dwarf=", optionid::none, JOINED|NOCACHE },
+    { "-fexceptions", optionid::exceptions, 0 },
+    { "-fno-exceptions", optionid::noexceptions, 0 },
+    { "-mwindows", optionid::mwindows, LINKONLY },
+    { "-mdll", optionid::mdll, LINKONLY },
+    { "-mconsole", optionid::mconsole, LINKONLY },
+    { "-fprofile-use", optionid::none, NOCACHE },
+    { "-fprofile-use=", optionid::none, JOINED|NOCACHE },
+    { "-fprofile-instr-use", optionid::none, NOCACHE },
+    { "-fprofile-instr-use=", optionid::none, JOINED|NOCACHE },
+    { "-fmodules", optionid::none, NOCACHE }, /* -wc-modules */
+    { "-ftime-trace", optionid::none, NOCACHE },
+    { "-ftime-trace=", optionid::none, JOINED|NOCACHE },
+    { "-ftime-trace-granularity=", optionid::none, JOINED|NOCACHE },
+    { "-fsanitize-blacklist=", optionid::none, JOINED|NOCACHE },
+    { "-fsanitize-ignorelist=", optionid::none, JOINED|NOCACHE },
+
+    /*
+     * Dependency files
+     */
+
+    { "-M", optionid::none, NOLINK|NOCACHE },
+    { "-MM", optionid::none, NOLINK|NOCACHE },
+    { "-MJ", optionid::none, SEPARATE|JOINED|NOLINK|NOCACHE },
+    { "-MD", optionid::deps, NOLINK|NOKEY },
+    { "-MMD", optionid::deps, NOLINK|NOKEY },
+    { "-MP", optionid::none, NOLINK|NOKEY },
+    { "-MG", optionid::none, NOLINK|NOKEY },
+    { "-MF", optionid::depfile, SEPARATE|JOINED|NOLINK|NOKEY },
+    { "-MT", optionid::deptarget, SEPARATE|JOINED|NOLINK|NOKEY },
+    { "-MQ", optionid::deptarget, SEPARATE|JOINED|NOLINK|NOKEY },
+
+    /*
+     * Preprocessor
+     */
+
+    { "-I", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-D", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-U", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-include", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-imacros", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-isystem", optionid::isystem, SEPARATE|JOINED|PPONLY },
+    { "-idirafter", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-iquote", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-iprefix", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-iwithprefix", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-iwithprefixbefore", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-isysroot", optionid::none, SEPARATE|JOINED|PPONLY },
+    { "-ivfsoverlay", optionid::none, SEPARATE|PPONLY },
+    { "-include-pch", optionid::none, SEPARATE|PPONLY },
+
+    /*
+     * Driver
+     */
+
+    { "-target", optionid::none, SEPARATE },
+    { "-arch", optionid::none, SEPARATE },
+    { "-ccc-host-triple", optionid::none, SEPARATE },
+    { "-Xclang", optionid::none, SEPARATE },
+    { "-Xpreprocessor", optionid::none, SEPARATE|PPONLY },
+    { "-Xassembler", optionid::none, SEPARATE },
+    { "--param", optionid::none, SEPARATE },
+
+    /*
+     * Link step
+     */
+
+    { "-Xlinker", optionid::none, SEPARATE|LINKONLY },
+    { "-Wl,", optionid::none, JOINED|LINKONLY },
+    { "-fuse-ld=", optionid::none, JOINED|LINKONLY },
+    { "-L", optionid::none, SEPARATE|JOINED|LINKONLY },
+    { "-l", optionid::none, SEPARATE|JOINED|LINKONLY },
+    { "-u", optionid::none, SEPARATE|LINKONLY },
+    { "-z", optionid::none, SEPARATE|LINKONLY },
+    { "-shared", optionid::shared, LINKONLY },
+    { "-static", optionid::none, LINKONLY },
+    { "-static-libgcc", optionid::none, LINKONLY },
+    { "-static-libstdc++", optionid::none, LINKONLY },
+    { "-s", optionid::none, LINKONLY },
+    { "-rdynamic", optionid::none, LINKONLY },
+    { "-nostdlib", optionid::none, LINKONLY },
+    { "-nodefaultlibs", optionid::none, LINKONLY },
+    { "-nostartfiles", optionid::none, LINKONLY },
+    { "-pie", optionid::none, LINKONLY },
+    { "-no-pie", optionid::none, LINKONLY },
+
+    /*
+     * wclang commands (COMMANDPREFIX)
+     */
+
+    { "-wc-arch", optionid::wc_arch, WCLANG },
+    { "-wc-a", optionid::wc_arch, WCLANG },
+    { "-wc-append-exe", optionid::wc_append_exe, WCLANG },
+    { "-wc-auto-pch", optionid::wc_auto_pch, WCLANG },
+    { "-wc-auto-pch=", optionid::wc_auto_pch, WCLANG|JOINED },
+    { "-wc-batch=", optionid::wc_batch, WCLANG|JOINED },
+    { "-wc-cache", optionid::wc_cache, WCLANG },
+    { "-wc-cache-stats", optionid::wc_cache_stats, WCLANG },
+    { "-wc-case-insensitive", optionid::wc_case_insensitive, WCLANG },
+    { "-wc-compdb=", optionid::wc_compdb, WCLANG|JOINED },
+    { "-wc-compdb-compact", optionid::wc_compdb_compact, WCLANG },
+    { "-wc-compdb-compact=", optionid::wc_compdb_compact, WCLANG|JOINED },
+    { "-wc-distribute", optionid::wc_distribute, WCLANG },
+    { "-wc-distribute=", optionid::wc_distribute, WCLANG|JOINED },
+    { "-wc-env", optionid::wc_env, WCLANG },
+    { "-wc-e", optionid::wc_env, WCLANG },
+    { "-wc-env-", optionid::wc_env_var, WCLANG|JOINED },
+    { "-wc-e-", optionid::wc_env_var, WCLANG|JOINED },
+    { "-wc-fail-fast", optionid::wc_fail_fast, WCLANG },
+    { "-wc-header-map", optionid::wc_header_map, WCLANG },
+    { "-wc-help", optionid::wc_help, WCLANG },
+    { "-wc-h", optionid::wc_help, WCLANG },
+    { "-wc-import=", optionid::wc_import, WCLANG|JOINED },
+    { "-wc-jobs", optionid::wc_jobs, WCLANG },
+    { "-wc-jobs=", optionid::wc_jobs, WCLANG|JOINED },
+    { "-wc-linker=", optionid::wc_linker, WCLANG|JOINED },
+    { "-wc-link-threads=", optionid::wc_link_threads, WCLANG|JOINED },
+    { "-wc-modules", optionid::wc_modules, WCLANG },
+    { "-wc-modules=", optionid::wc_modules, WCLANG|JOINED },
+    { "-wc-no-intrin", optionid::wc_no_intrin, WCLANG },
+    { "-wc-static-runtime", optionid::wc_static_runtime, WCLANG },
+    { "-wc-target", optionid::wc_target, WCLANG },
+    { "-wc-t", optionid::wc_target, WCLANG },
+    { "-wc-targets=", optionid::wc_targets, WCLANG|JOINED },
+    { "-wc-thinlto", optionid::wc_thinlto, WCLANG },
+    { "-wc-trace=", optionid::wc_trace, WCLANG|JOINED },
+    { "-wc-use-mingw-linker", optionid::wc_use_mingw_linker, WCLANG },
+    { "-wc-version", optionid::wc_version, WCLANG },
+    { "-wc-v", optionid::wc_version, WCLANG },
+    { "-wc-verbose", optionid::wc_verbose, WCLANG }
+};
+
+#undef SEPARATE
+#undef JOINED
+#undef NOLINK
+#undef LINKONLY
+#undef NOCACHE
+#undef NOKEY
+#undef WCLANG
+#undef PPONLY
+
+static constexpr size_t NOPTIONS = sizeof(OPTIONS) / sizeof(OPTIONS[0]);
+static constexpr auto OPTIONINDEX = maketableindex<256>(OPTIONS);
+
+/*
+ * Bit n is set if there is a joined option of length n,
+ * so that findoption() only probes those prefixes
+ */
+
+static constexpr ullong joinedlengths(size_t i = 0)
+{
+    return i == NOPTIONS ? 0 :
+           ((OPTIONS[i].flags & OPT_JOINED) ? 1ULL << constexprstrlen(OPTIONS[i].name) : 0) |
+           joinedlengths(i+1);
+}
+
+static constexpr bool checkoptions(size_t i = 0)
+{
+    return i == NOPTIONS ||
+           (constexprstrlen(OPTIONS[i].name) < 64 && checkoptions(i+1));
+}
+
+static_assert(checkoptions(), "option names must be shorter than 64 chars");
+
+static constexpr ullong JOINEDLENGTHS = joinedlengths();
+
+const optioninfo *findoption(const char *arg, const char **value)
+{
+    const optioninfo *match = nullptr;
+    size_t matchlen = 0;
+    ullong h = TABLEHASH_INIT;
+    size_t len = 0;
+
+    /*
+     * The hash of every prefix falls out of hashing
+     * the whole argument, no substrings are built
+     */
+
+    for (const char *p = arg; *p; ++p)
+    {
+        h = (h ^ (unsigned char)*p) * TABLEHASH_PRIME;
+
+        if (++len < 64 && (JOINEDLENGTHS & (1ULL << len)) && p[1])
+        {
+            const optioninfo *opt = tablelookup(OPTIONS, OPTIONINDEX, h, arg, len);
+
+            if (opt && (opt->flags & OPT_JOINED))
+            {
+                match = opt;
+                matchlen = len;
+            }
+        }
+    }
+
+    if (const optioninfo *opt = tablelookup(OPTIONS, OPTIONINDEX, h, arg, len))
+    {
+        match = opt;
+        matchlen = len;
+    }
+
+    if (match && value)
+        *value = arg + matchlen;
+
+    return match;
+}
@@ -0,0 +1,176 @@
+/*
+ * Compile-time generated lookup tables
+ *
+ * The entries are hashed (FNV-1a) into a fixed number of
+ * buckets at compile time; a lookup hashes the name once
+ * and compares against the (usually single) entry of its
+ * bucket instead of walking the whole table.
+ */
+
+constexpr ullong TABLEHASH_INIT = 0xcbf29ce484222325ULL;
+constexpr ullong TABLEHASH_PRIME = 0x100000001b3ULL;
+
+constexpr ullong tablehash(const char *str, size_t len, ullong h = TABLEHASH_INIT)
+{
+    return len ? tablehash(str+1, len-1, (h ^ (unsigned char)*str) * TABLEHASH_PRIME) : h;
+}
+
+constexpr size_t constexprstrlen(const char *str)
+{
+    return *str ? 1 + constexprstrlen(str+1) : 0;
+}
+
+template<class T>
+constexpr size_t tablebucket(const T *entries, size_t i, size_t nbuckets)
+{
+    return tablehash(entries[i].name, constexprstrlen(entries[i].name)) % nbuckets;
+}
+
+template<class T>
+constexpr short firstinbucket(const T *entries, size_t n, size_t bucket,
+                              size_t nbuckets, size_t i = 0)
+{
+    return i == n ? -1 :
+           tablebucket(entries, i, nbuckets) == bucket ? static_cast<short>(i) :
+           firstinbucket(entries, n, bucket, nbuckets, i+1);
+}
+
+template<class T>
+constexpr short nextinbucket(const T *entries, size_t n, size_t i,
+                             size_t nbuckets, size_t j)
+{
+    return j == n ? -1 :
+           tablebucket(entries, j, nbuckets) == tablebucket(entries, i, nbuckets) ?
+           static_cast<short>(j) :
+           nextinbucket(entries, n, i, nbuckets, j+1);
+}
+
+template<size_t... I> struct indexlist {};
+template<size_t N, size_t... I> struct makeindexlist : makeindexlist<N-1, N-1, I...> {};
+template<size_t... I> struct makeindexlist<0, I...> { typedef indexlist<I...> type; };
+
+template<size_t NBUCKETS, size_t NENTRIES>
+struct tableindex {
+    short first[NBUCKETS];
+    short next[NENTRIES];
+};
+
+template<class T, size_t... B, size_t... E>
+constexpr tableindex<sizeof...(B), sizeof...(E)>
+maketableindex(const T *entries, indexlist<B...>, indexlist<E...>)
+{
+    return {{ firstinbucket(entries, sizeof...(E), B, sizeof...(B))... },
+            { nextinbucket(entries, sizeof...(E), E, sizeof...(B), E+1)... }};
+}
+
+template<size_t NBUCKETS, class T, size_t N>
+constexpr tableindex<NBUCKETS, N> maketableindex(const T (&entries)[N])
+{
+    static_assert(NBUCKETS && !(NBUCKETS & (NBUCKETS-1)), "bucket count must be a power of 2");
+    return maketableindex(entries, typename makeindexlist<NBUCKETS>::type(),
+                          typename makeindexlist<N>::type());
+}
+
+template<class T, size_t NBUCKETS, size_t N>
+const T *tablelookup(const T (&entries)[N], const tableindex<NBUCKETS, N> &index,
+                     ullong h, const char *str, size_t len)
+{
+    for (short i = index.first[h & (NBUCKETS-1)]; i != -1; i = index.next[i])
+    {
+        const char *name = entries[i].name;
+
+        if (!std::strncmp(name, str, len) && !name[len])
+            return &entries[i];
+    }
+
+    return nullptr;
+}
+
+template<class T, size_t NBUCKETS, size_t N>
+const T *tablelookup(const T (&entries)[N], const tableindex<NBUCKETS, N> &index,
+                     const char *str, size_t len)
+{
+    return tablelookup(entries, index, tablehash(str, len), str, len);
+}
+
+/*
+ * Compiler and wclang options
+ *
+ * One table for the argument parser, the object cache
+ * and the parallel build, carrying how an option takes
+ * its value and how it affects the link step and the
+ * cache key.
+ */
+
+enum optionflags : unsigned {
+    OPT_SEPARATE = 1 << 0, /* value in the next argument: -o <file> */
+    OPT_JOINED   = 1 << 1, /* value attached to the option: -O2, -Idir */
+    OPT_NOLINK   = 1 << 2, /* invocation does not link */
+    OPT_LINKONLY = 1 << 3, /* only used by the link step */
+    OPT_NOCACHE  = 1 << 4, /* compile step is not cacheable */
+    OPT_NOKEY    = 1 << 5, /* names an output, not passed to the preprocessor */
+    OPT_WCLANG   = 1 << 6, /* -wc-* command */
+    OPT_PPONLY   = 1 << 7  /* only used by the preprocessor */
+};
+
+enum class optionid : unsigned char {
+    none = 0,
+    compile,
+    exceptions,
+    noexceptions,
+    mwindows,
+    mdll,
+    mconsole,
+    output,
+    language,
+    optimize,
+    debug,
+    deps,
+    depfile,
+    deptarget,
+    isystem,
+    shared,
+    wc_arch,
+    wc_append_exe,
+    wc_auto_pch,
+    wc_batch,
+    wc_cache,
+    wc_cache_stats,
+    wc_case_insensitive,
+    wc_compdb,
+    wc_compdb_compact,
+    wc_distribute,
+    wc_env,
+    wc_env_var,
+    wc_fail_fast,
+    wc_header_map,
+    wc_help,
+    wc_import,
+    wc_jobs,
+    wc_linker,
+    wc_link_threads,
+    wc_modules,
+    wc_no_intrin,
+    wc_static_runtime,
+    wc_target,
+    wc_targets,
+    wc_thinlto,
+    wc_trace,
+    wc_use_mingw_linker,
+    wc_version,
+    wc_verbose
+};
+
+struct optioninfo {
+    const char *name;
+    optionid id;
+    unsigned flags;
+};
+
+/*
+ * Looks up an argument, either by its full name or by
+ * the longest joined option it starts with. *value points
+ * to the attached value (an empty string if there is none).
+ */
+
+const optioninfo *findoption(const char *arg, const char **value = nullptr);
@@ -0,0 +1,335 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <iostream>
+#include <cstring>
+#include <climits>
+#include <set>
+#include <unistd.h>
+#include "wclang.h"
+#include "wclang_cache.h"
+#include "wclang_options.h"
+#include "wclang_rc.h"
+
+/*
+ * The cache key covers the resource compiler, the target, the
+ * preprocessor flags, the script and every file it may refer
+ * to: each quoted string of the script (and of the quoted
+ * #includes, recursively) that names an existing file, looked
+ * up relative to the script, the working directory and the -I
+ * directories like windres does.
+ */
+
+static constexpr char RESOURCESVERSION[] = "1";
+
+static constexpr const char* RESOURCEINCLUDEEXTENSIONS[] = {
+    ".h", ".hh", ".hpp", ".rc", ".rc2", ".rh", ".dlg", ".inc"
+};
+
+static bool hasextension(const std::string &file, const char *ext)
+{
+    size_t len = std::strlen(ext);
+    return file.size() > len && !file.compare(file.size()-len, len, ext);
+}
+
+static void hashresourcefile(const std::string &file, const string_vector &includedirs,
+                             std::set<std::string> &seen, hash128 &key)
+{
+    std::string content;
+
+    if (!seen.insert(file).second || !readfile(file.c_str(), content))
+        return;
+
+    key.update("file " + file);
+    key.update(content);
+
+    bool isscript = false;
+
+    for (const char *ext : RESOURCEINCLUDEEXTENSIONS)
+        if (hasextension(file, ext)) isscript = true;
+
+    if (!isscript)
+        return;
+
+    size_t slash = file.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : file.substr(0, slash);
+    size_t pos = 0;
+
+    while ((pos = content.find('"', pos)) != std::string::npos)
+    {
+        size_t end = content.find_first_of("\"\n", pos+1);
+
+        if (end == std::string::npos || content[end] != '"')
+        {
+            pos = end;
+            continue;
+        }
+
+        std::string name = content.substr(pos+1, end-pos-1);
+        pos = end+1;
+
+        if (name.empty() || name.size() >= PATH_MAX)
+            continue;
+
+        /* "res\\app.ico" */
+        for (size_t i = 0; (i = name.find("\\\\", i)) != std::string::npos; ++i)
+            name.replace(i, 2, "/");
+
+        for (char &c : name)
+            if (c == '\\') c = '/';
+
+        if (name[0] == '/')
+        {
+            if (fileexists(name.c_str()))
+                hashresourcefile(name, includedirs, seen, key);
+
+            continue;
+        }
+
+        if (fileexists((dir + "/" + name).c_str()))
+            hashresourcefile(dir + "/" + name, includedirs, seen, key);
+
+        if (fileexists(name.c_str()))
+            hashresourcefile(name, includedirs, seen, key);
+
+        for (const auto &includedir : includedirs)
+        {
+            if (fileexists((includedir + "/" + name).c_str()))
+                hashresourcefile(includedir + "/" + name, includedirs, seen, key);
+        }
+    }
+}
+
+static bool compileresource(const string_vector &windres, const std::string &rc,
+                            const string_vector &includedirs, std::string &object)
+{
+    std::string dir;
+    std::string err;
+    std::set<std::string> seen;
+    hash128 key;
+
+    if (!getcachedir(dir, "resources"))
+        return false;
+
+    key.update(std::string("wclang-resources ") + RESOURCESVERSION);
+    key.update(fileidentity(windres[0].c_str()));
+
+    for (const auto &arg : windres)
+        key.update(arg);
+
+    if (!fileexists(rc.c_str()))
+    {
+        std::cerr << "cannot read " << rc << std::endl;
+        return false;
+    }
+
+    hashresourcefile(rc, includedirs, seen, key);
+    object = dir + "/" + key.str() + ".o";
+
+    if (fileexists(object.c_str()))
+        return true;
+
+    if (!mkdirs(dir))
+        return false;
+
+    std::stringstream tmp;
+    tmp << object << ".tmp." << getpid();
+
+    string_vector args = windres;
+    args.push_back("-i");
+    args.push_back(rc);
+    args.push_back("-o");
+    args.push_back(tmp.str());
+
+    std::vector<char*> cargs;
+
+    for (auto &arg : args)
+        cargs.push_back(&arg[0]);
+
+    cargs.push_back(nullptr);
+
+    int ret = runprocess(cargs.data(), nullptr, &err);
+    std::cerr << err;
+
+    if (ret != 0 || rename(tmp.str().c_str(), object.c_str()))
+    {
+        if (ret == RUNCOMMAND_ERROR)
+            std::cerr << "cannot run " << windres[0] << std::endl;
+
+        unlink(tmp.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static std::vector<char*> resourcecargs;
+static string_vector resourceobjects;
+
+int compileresources(const char *compiler, const char *target, char **&cargs)
+{
+    string_vector windres;
+    string_vector includedirs;
+    string_vector systemdirs;
+    std::vector<size_t> scripts;
+    const char *output = nullptr;
+    bool compileonly = false;
+    size_t inputs = 0;
+    size_t n = 0;
+
+    windres.push_back(compiler);
+    windres.push_back("-O");
+    windres.push_back("coff");
+    windres.push_back("-F");
+    windres.push_back(target);
+
+    /* the include paths and macros wclang passes to clang */
+
+    for (n = 1; cargs[n]; ++n)
+    {
+        const char *arg = cargs[n];
+        const char *value;
+        const optioninfo *opt;
+
+        if (*arg != '-')
+        {
+            if (hasextension(arg, ".rc"))
+                scripts.push_back(n);
+
+            ++inputs;
+            continue;
+        }
+
+        if (!(opt = findoption(arg, &value)))
+            continue;
+
+        if ((opt->flags & OPT_SEPARATE) && !*value && cargs[n+1])
+            value = cargs[++n];
+
+        if (opt->id == optionid::compile)
+        {
+            compileonly = true;
+        }
+        else if (opt->id == optionid::output)
+        {
+            output = value;
+        }
+        else if (opt->id == optionid::isystem)
+        {
+            systemdirs.push_back(value);
+        }
+        else if (!std::strcmp(opt->name, "-I"))
+        {
+            includedirs.push_back(value);
+            windres.push_back("-I");
+            windres.push_back(value);
+        }
+        else if (!std::strcmp(opt->name, "-D") || !std::strcmp(opt->name, "-U"))
+        {
+            windres.push_back(opt->name);
+            windres.push_back(value);
+        }
+    }
+
+    if (scripts.empty())
+        return RESOURCES_NOT_APPLICABLE;
+
+    /* the -I directories of the command line are searched first */
+
+    for (const auto &dir : systemdirs)
+    {
+        windres.push_back("-I");
+        windres.push_back(dir);
+    }
+
+    resourceobjects.clear();
+    resourceobjects.reserve(scripts.size());
+
+    for (size_t i : scripts)
+    {
+        std::string object;
+
+        if (!compileresource(windres, cargs[i], includedirs, object))
+        {
+            std::cerr << "cannot compile resource script " << cargs[i] << std::endl;
+            return 1;
+        }
+
+        resourceobjects.push_back(object);
+    }
+
+    if (compileonly)
+    {
+        /* w32-clang -c app.rc [-o app.o] */
+
+        for (size_t i = 0; i < scripts.size(); ++i)
+        {
+            std::string file;
+            std::string content;
+
+            if (output && inputs == 1)
+            {
+                file = output;
+            }
+            else
+            {
+                file = getfileName(cargs[scripts[i]]);
+                file = file.substr(0, file.size() - STRLEN(".rc")) + ".o";
+            }
+
+            if (!readfile(resourceobjects[i].c_str(), content) ||
+                !writefileatomic(file, content))
+            {
+                std::cerr << "cannot write " << file << std::endl;
+                return 1;
+            }
+        }
+
+        if (inputs == scripts.size())
+            return 0;
+    }
+
+    /*
+     * Link the objects in place of the scripts, a compile
+     * step goes on with the remaining sources
+     */
+
+    resourcecargs.clear();
+
+    for (size_t i = 0, j = 0; i < n; ++i)
+    {
+        if (j < scripts.size() && scripts[j] == i)
+        {
+            if (!compileonly)
+                resourcecargs.push_back(&resourceobjects[j][0]);
+
+            ++j;
+            continue;
+        }
+
+        resourcecargs.push_back(cargs[i]);
+    }
+
+    resourcecargs.push_back(nullptr);
+    cargs = resourcecargs.data();
+
+    return RESOURCES_NOT_APPLICABLE;
+}
@@ -0,0 +1,14 @@
+/*
+ * Resource scripts (.rc inputs)
+ *
+ * Compiles the .rc files among the compiler arguments to COFF
+ * objects with the given resource compiler (llvm-windres or
+ * the mingw windres) and caches them by the content of the
+ * script and the files it refers to. A link gets the objects
+ * in place of the scripts, 'w32-clang -c app.rc' writes the
+ * object and is done (returns the exit code).
+ */
+
+constexpr int RESOURCES_NOT_APPLICABLE = -1;
+
+int compileresources(const char *compiler, const char *target, char **&cargs);
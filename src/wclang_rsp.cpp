@@ -0,0 +1,291 @@
+/***********************************************************************
+ *  wclang                                                             *
+ *  Copyright (C) 2013-2019 Thomas Poechtrager                         *
+ *  t.poechtrager@gmail.com                                            *
+ *                                                                     *
+ *  This program is free software; you can redistribute it and/or      *
+ *  modify it under the terms of the GNU General Public License        *
+ *  as published by the Free Software Foundation; either version 2     *
+ *  of the License, or (at your option) any later version.             *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the      *
+ *  GNU General Public License for more details.                       *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, write to the Free Software        *
+ *  Foundation, Inc.,                                                  *
+ *  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.      *
+ ***********************************************************************/
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "wclang.h"
+#include "wclang_rsp.h"
+
+/*
+ * Same limit as gcc
+ */
+
+static constexpr int MAXRSPDEPTH = 2000;
+
+static stringarena rsparena;
+
+/*
+ * Maps the file writable (but private), so the arguments can be
+ * unquoted and terminated in place. The byte after the end of the
+ * file is always available and zero.
+ */
+
+static bool mapfile(const char *file, char *&data, size_t &size)
+{
+    static const size_t pagesize = sysconf(_SC_PAGESIZE);
+    struct stat st;
+    int fd;
+
+    if ((fd = open(file, O_RDONLY)) == -1)
+        return false;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    data = nullptr;
+
+    if (size % pagesize)
+    {
+        void *p = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (p != MAP_FAILED)
+            data = static_cast<char*>(p);
+    }
+
+    if (!data)
+    {
+        /* empty, page aligned or not mappable */
+        size_t n = 0;
+        ssize_t r;
+
+        data = rsparena.alloc(size+1);
+
+        while (n < size && ((r = read(fd, data+n, size-n)) > 0 || (r == -1 && errno == EINTR)))
+            if (r > 0) n += r;
+
+        size = n;
+        data[size] = '\0';
+    }
+
+    close(fd);
+    return true;
+}
+
+static void addargument(char *arg, std::vector<char*> &args, int depth);
+
+/*
+ * GNU (libiberty) quoting: arguments are separated by white space,
+ * a backslash escapes any character, single and double quotes
+ * group characters
+ */
+
+static void splitresponsefile(char *p, char *end, std::vector<char*> &args, int depth)
+{
+    for (;;)
+    {
+        while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+            ++p;
+
+        if (p == end)
+            break;
+
+        char *arg = p;
+        char *out = p;
+        bool squote = false;
+        bool dquote = false;
+        bool bsquote = false;
+
+        for (; p < end; ++p)
+        {
+            char c = *p;
+
+            if (bsquote)
+            {
+                bsquote = false;
+                *out++ = c;
+            }
+            else if (c == '\\') {
+                bsquote = true;
+            }
+            else if (squote) {
+                if (c == '\'') squote = false;
+                else *out++ = c;
+            }
+            else if (dquote) {
+                if (c == '"') dquote = false;
+                else *out++ = c;
+            }
+            else if (std::isspace(static_cast<unsigned char>(c))) {
+                break;
+            }
+            else if (c == '\'') {
+                squote = true;
+            }
+            else if (c == '"') {
+                dquote = true;
+            }
+            else {
+                *out++ = c;
+            }
+        }
+
+        if (p < end)
+            ++p; /* the terminator may overwrite the separator */
+
+        *out = '\0';
+        addargument(arg, args, depth);
+    }
+}
+
+static void addargument(char *arg, std::vector<char*> &args, int depth)
+{
+    char *data;
+    size_t size;
+
+    if (*arg != '@' || !mapfile(arg+1, data, size))
+    {
+        /* not a response file, or it cannot be read: pass it on as is */
+        args.push_back(arg);
+        return;
+    }
+
+    if (depth >= MAXRSPDEPTH)
+    {
+        std::cerr << "response files nested too deeply: " << arg << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    splitresponsefile(data, data+size, args, depth+1);
+}
+
+void splitarguments(char *begin, char *end, std::vector<char*> &args)
+{
+    splitresponsefile(begin, end, args, 0);
+}
+
+void expandresponsefiles(int &argc, char **&argv)
+{
+    static std::vector<char*> args;
+    int i;
+
+    for (i = 1; i < argc; ++i)
+        if (*argv[i] == '@') break;
+
+    if (i == argc)
+        return;
+
+    args.assign(argv, argv+i);
+
+    for (; i < argc; ++i)
+        addargument(argv[i], args, 0);
+
+    argc = args.size();
+    args.push_back(nullptr);
+    argv = args.data();
+}
+
+/*
+ * Outgoing response file
+ *
+ * The file is unlinked right away and handed over as
+ * /dev/fd/<n>, so nothing is left behind after exec()
+ */
+
+static void appendquoted(std::string &content, const char *arg)
+{
+    if (!*arg)
+        content += "\"\"";
+
+    for (; *arg; ++arg)
+    {
+        if (std::isspace(static_cast<unsigned char>(*arg)) ||
+            *arg == '\'' || *arg == '"' || *arg == '\\')
+        {
+            content += '\\';
+        }
+
+        content += *arg;
+    }
+
+    content += '\n';
+}
+
+char *const *useresponsefile(char *const *args)
+{
+    static std::string rsparg;
+    static char *rspargs[3];
+    size_t threshold = RSP_THRESHOLD;
+    size_t len = 0;
+    const char *p;
+    char file[PATH_MAX];
+    int fd;
+
+    if ((p = getenv("WCLANG_RSP_THRESHOLD")) && *p)
+        threshold = std::strtoull(p, nullptr, 10);
+
+    for (char *const *arg = args; *arg; ++arg)
+        len += std::strlen(*arg) + 1;
+
+    if (len <= threshold || !args[0] || !args[1])
+        return args;
+
+    if (!(p = getenv("TMPDIR")) || !*p)
+        p = "/tmp";
+
+    if (std::snprintf(file, sizeof(file), "%s/wclang-rsp.XXXXXX", p) >= (int)sizeof(file) ||
+        (fd = mkstemp(file)) == -1)
+    {
+        return args;
+    }
+
+    unlink(file);
+
+    std::string content;
+    content.reserve(len + len/8);
+
+    for (char *const *arg = args+1; *arg; ++arg)
+        appendquoted(content, *arg);
+
+    size_t n = 0;
+    ssize_t r;
+
+    while (n < content.size() &&
+           ((r = write(fd, content.c_str()+n, content.size()-n)) > 0 || (r == -1 && errno == EINTR)))
+    {
+        if (r > 0) n += r;
+    }
+
+    if (n != content.size() || lseek(fd, 0, SEEK_SET) == -1)
+    {
+        close(fd);
+        return args;
+    }
+
+    rsparg = "@/dev/fd/" + std::to_string(fd);
+
+    rspargs[0] = args[0];
+    rspargs[1] = &rsparg[0];
+    rspargs[2] = nullptr;
+
+    return rspargs;
+}
@@ -0,0 +1,13 @@
+/*
+ * Response files (@file)
+ *
+ * Incoming @file arguments are expanded before the arguments
+ * are parsed, outgoing command lines longer than
+ * WCLANG_RSP_THRESHOLD bytes are passed in a response file.
+ */
+
+constexpr size_t RSP_THRESHOLD = 131072;
+
+void expandresponsefiles(int &argc, char **&argv);
+void splitarguments(char *begin, char *end, std::vector<char*> &args);
+char *const *useresponsefile(char *const *args);
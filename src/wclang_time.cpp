@@ -21,6 +21,11 @@
 
 #include <tuple>
 #include <stdexcept>
+#include <fstream>
+#include <cstring>
+#include <cctype>
+#include <sys/time.h>
+#include <unistd.h>
 #include "wclang.h"
 #include "wclang_time.h"
 
@@ -53,3 +58,193 @@ ullong getmicrodiff(time_point &start, time_point time)
     return time-start;
 }
 #endif
+
+/*
+ * Chrome trace events
+ *
+ * Spans are written as complete ("X") events with microsecond
+ * timestamps since the epoch, so they line up with clang's
+ * -ftime-trace output.
+ */
+
+ullong statcalls = 0;
+ullong opendircalls = 0;
+ullong readlinkcalls = 0;
+ullong realpathcalls = 0;
+ullong execcalls = 0;
+
+struct traceevent {
+    const char *name;
+    std::string detail;
+    ullong begin;
+    ullong end;
+    ullong stats;
+    ullong opendirs;
+};
+
+static std::string tracefile;
+static std::vector<traceevent> traceevents;
+
+void enabletrace(const char *file)
+{
+    tracefile = file;
+}
+
+bool istraceenabled()
+{
+    return !tracefile.empty();
+}
+
+ullong gettracetime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec*1000000ULL + tv.tv_usec;
+}
+
+tracespan::tracespan(const char *name, const std::string &detail)
+    : name(name), detail(detail), begin(), stats(statcalls),
+      opendirs(opendircalls), active(istraceenabled())
+{
+    if (active)
+        begin = gettracetime();
+}
+
+void tracespan::end()
+{
+    if (!active)
+        return;
+
+    traceevent ev = { name, detail, begin, gettracetime(),
+                      statcalls-stats, opendircalls-opendirs };
+
+    traceevents.push_back(ev);
+    active = false;
+}
+
+/*
+ * Returns the value of the top-level number field <key>
+ * of a JSON object, or -1
+ */
+
+static long long getjsonnumber(const std::string &obj, const char *key, size_t *pos = nullptr,
+                               size_t *len = nullptr)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t p = obj.find(pattern);
+
+    if (p == std::string::npos)
+        return -1;
+
+    p += pattern.size();
+    while (p < obj.size() && obj[p] == ' ') ++p;
+
+    size_t end = p;
+    while (end < obj.size() && (isdigit(obj[end]) || obj[end] == '-')) ++end;
+
+    if (end == p)
+        return -1;
+
+    if (pos) *pos = p;
+    if (len) *len = end-p;
+
+    return std::atoll(obj.substr(p, end-p).c_str());
+}
+
+/*
+ * Appends the events of clang's -ftime-trace output,
+ * moved to our time base and into a thread of our process
+ */
+
+static void mergeclangtrace(std::ostream &out, const std::string &trace, int pid,
+                            ullong clangstart)
+{
+    long long base = getjsonnumber(trace, "beginningOfTime");
+    size_t pos = trace.find("\"traceEvents\"");
+
+    if (base < 0)
+        base = clangstart;
+
+    if (pos == std::string::npos || (pos = trace.find('[', pos)) == std::string::npos)
+        return;
+
+    int depth = 0;
+    bool instring = false;
+    size_t objstart = 0;
+
+    for (++pos; pos < trace.size(); ++pos)
+    {
+        char c = trace[pos];
+
+        if (instring)
+        {
+            if (c == '\\') ++pos;
+            else if (c == '"') instring = false;
+            continue;
+        }
+
+        if (c == '"') instring = true;
+        else if (c == '{' && !depth++) objstart = pos;
+        else if (c == '}' && !--depth)
+        {
+            std::string obj = trace.substr(objstart, pos-objstart+1);
+            size_t p, len;
+            long long ts = getjsonnumber(obj, "ts", &p, &len);
+
+            if (ts >= 0)
+                obj.replace(p, len, std::to_string(base+ts));
+
+            if (getjsonnumber(obj, "pid", &p, &len) >= 0)
+                obj.replace(p, len, std::to_string(pid));
+
+            if (getjsonnumber(obj, "tid", &p, &len) >= 0)
+                obj.replace(p, len, "0");
+
+            out << ",\n" << obj;
+        }
+        else if (c == ']' && !depth) break;
+    }
+}
+
+bool writetrace(const std::string &clangtrace)
+{
+    if (!istraceenabled())
+        return true;
+
+    std::ofstream out(tracefile.c_str(), std::ios::trunc);
+    int pid = getpid();
+    ullong clangstart = 0;
+
+    if (!out)
+        return false;
+
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"tid\":" << pid << ",\"args\":{\"name\":\"wclang\"}}";
+
+    for (const auto &ev : traceevents)
+    {
+        out << ",\n{\"name\":\"" << jsonescape(ev.name) << "\",\"cat\":\"wclang\","
+            << "\"ph\":\"X\",\"ts\":" << ev.begin << ",\"dur\":" << ev.end-ev.begin
+            << ",\"pid\":" << pid << ",\"tid\":" << pid << ",\"args\":{";
+
+        if (!ev.detail.empty())
+            out << "\"detail\":\"" << jsonescape(ev.detail) << "\",";
+
+        out << "\"stat\":" << ev.stats << ",\"opendir\":" << ev.opendirs << "}}";
+
+        if (!std::strcmp(ev.name, "compiler"))
+            clangstart = ev.begin;
+    }
+
+    if (!clangtrace.empty())
+    {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"tid\":0,\"args\":{\"name\":\"clang -ftime-trace\"}}";
+
+        mergeclangtrace(out, clangtrace, pid, clangstart);
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return !!out.flush();
+}
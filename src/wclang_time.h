@@ -12,3 +12,38 @@ time_point getticks();
 
 typedef std::tuple<const char*, time_point> time_tuple;
 typedef std::vector<time_tuple> time_vector;
+
+/*
+ * Chrome trace event recording (-wc-trace=<file>)
+ */
+
+/*
+ * Filesystem and process counters, reported per span
+ * and checked by the budget tests
+ */
+
+extern ullong statcalls;
+extern ullong opendircalls;
+extern ullong readlinkcalls;
+extern ullong realpathcalls;
+extern ullong execcalls;
+
+void enabletrace(const char *file);
+bool istraceenabled();
+ullong gettracetime();
+bool writetrace(const std::string &clangtrace = std::string());
+
+class tracespan {
+public:
+    tracespan(const char *name, const std::string &detail = std::string());
+    ~tracespan() { end(); }
+    void end();
+
+private:
+    const char *name;
+    std::string detail;
+    ullong begin;
+    ullong stats;
+    ullong opendirs;
+    bool active;
+};